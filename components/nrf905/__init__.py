@@ -1,22 +1,95 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome import pins
-from esphome.components import fan, spi
-from esphome.const import CONF_ID
+from esphome.components import fan, sensor, spi
+from esphome.core import CORE
+from esphome.const import (
+    CONF_DATA_RATE,
+    CONF_ID,
+    DEVICE_CLASS_DURATION,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_SECOND,
+)
 
 CONF_AM_PIN = "am_pin"
+CONF_AUTO_RETRANSMIT = "auto_retransmit"
 CONF_CD_PIN = "cd_pin"
 CONF_CE_PIN = "ce_pin"
 CONF_DR_PIN = "dr_pin"
+CONF_IDLE_TIME = "idle_time"
+CONF_POWER_DOWN_TIME = "power_down_time"
 CONF_PWR_PIN = "pwr_pin"
+CONF_RADIO_TASK = "radio_task"
+CONF_RECEIVE_TIME = "receive_time"
+CONF_REGISTER_VERIFY = "register_verify"
+CONF_SPI_SELF_TEST = "spi_self_test"
+CONF_SPI_TRACE_SIZE = "spi_trace_size"
+CONF_TRANSMIT_TIME = "transmit_time"
 CONF_TXEN_PIN = "txen_pin"
 
 DEPENDENCIES = ["spi"]
+AUTO_LOAD = ["sensor"]
 
 nrf905_ns = cg.esphome_ns.namespace("nrf905")
 nRF905Component = nrf905_ns.class_("nRF905", fan.FanState)
+VerifyPolicy = nrf905_ns.enum("VerifyPolicy")
+Mode = nrf905_ns.enum("Mode")
+
+VERIFY_POLICIES = {
+    "NONE": VerifyPolicy.VerifyNone,
+    "CHANGED": VerifyPolicy.VerifyChanged,
+    "FULL": VerifyPolicy.VerifyFull,
+}
+
+MODES = {
+    "RECEIVE": Mode.Receive,
+    "IDLE": Mode.Idle,
+    "POWER_DOWN": Mode.PowerDown,
+}
+
+# Time spent in each radio mode
+MODE_TIME_SENSORS = {
+    CONF_POWER_DOWN_TIME: Mode.PowerDown,
+    CONF_IDLE_TIME: Mode.Idle,
+    CONF_RECEIVE_TIME: Mode.Receive,
+    CONF_TRANSMIT_TIME: Mode.Transmit,
+}
+
+MODE_TIME_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_SECOND,
+    icon="mdi:timer-outline",
+    accuracy_decimals=0,
+    device_class=DEVICE_CLASS_DURATION,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+# nRF905 SPI clock can go up to 10MHz
+MAX_DATA_RATE = 10e6
+
 
-CONFIG_SCHEMA = (
+def validate_radio_task(value):
+    value = cv.boolean(value)
+    if value and not (CORE.is_esp32 or CORE.is_host):
+        raise cv.Invalid("The radio task is only available on ESP32 and the host platform")
+    return value
+
+
+def validate_data_rate(config):
+    if config[CONF_DATA_RATE] > MAX_DATA_RATE:
+        raise cv.Invalid("nRF905 supports an SPI data rate of up to 10MHz")
+    return config
+
+
+def validate_radio_task_pins(config):
+    # Without DR the task could only poll the status over SPI, every millisecond
+    if config[CONF_RADIO_TASK] and CONF_DR_PIN not in config:
+        raise cv.Invalid("radio_task requires dr_pin")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
             cv.GenerateID(): cv.declare_id(nRF905Component),
@@ -24,12 +97,25 @@ CONFIG_SCHEMA = (
             cv.Required(CONF_CE_PIN): pins.gpio_output_pin_schema,
             cv.Required(CONF_PWR_PIN): pins.gpio_output_pin_schema,
             cv.Required(CONF_TXEN_PIN): pins.gpio_output_pin_schema,
-            cv.Optional(CONF_AM_PIN): pins.gpio_input_pin_schema,
-            cv.Optional(CONF_DR_PIN): pins.gpio_input_pin_schema,
+            cv.Optional(CONF_AM_PIN): pins.internal_gpio_input_pin_schema,
+            cv.Optional(CONF_DR_PIN): pins.internal_gpio_input_pin_schema,
+            cv.Optional(CONF_REGISTER_VERIFY, default="CHANGED"): cv.enum(
+                VERIFY_POLICIES, upper=True
+            ),
+            cv.Optional(CONF_SPI_SELF_TEST, default=False): cv.boolean,
+            cv.Optional(CONF_AUTO_RETRANSMIT, default=True): cv.boolean,
+            cv.Optional(CONF_RADIO_TASK, default=False): validate_radio_task,
+            # SPI transactions kept for dumpSpiTrace(), 8 bytes each; 0 disables the trace
+            cv.Optional(CONF_SPI_TRACE_SIZE, default=0): cv.int_range(
+                min=0, max=8192
+            ),
         }
     )
+    .extend({cv.Optional(key): MODE_TIME_SCHEMA for key in MODE_TIME_SENSORS})
     .extend(cv.COMPONENT_SCHEMA)
-    .extend(spi.spi_device_schema(cs_pin_required=True))
+    .extend(spi.spi_device_schema(cs_pin_required=True, default_data_rate="1MHz")),
+    validate_data_rate,
+    validate_radio_task_pins,
 )
 
 
@@ -53,3 +139,14 @@ async def to_code(config):
     cg.add(var.set_pwr_pin(data))
     data = await cg.gpio_pin_expression(config[CONF_TXEN_PIN])
     cg.add(var.set_txen_pin(data))
+
+    cg.add(var.set_verify_policy(config[CONF_REGISTER_VERIFY]))
+    cg.add(var.set_spi_self_test(config[CONF_SPI_SELF_TEST]))
+    cg.add(var.set_auto_retransmit(config[CONF_AUTO_RETRANSMIT]))
+    cg.add(var.set_radio_task(config[CONF_RADIO_TASK]))
+    cg.add(var.set_spi_trace_size(config[CONF_SPI_TRACE_SIZE]))
+
+    for key, mode in MODE_TIME_SENSORS.items():
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(var.set_mode_time_sensor(mode, sens))
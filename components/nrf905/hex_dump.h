@@ -0,0 +1,57 @@
+#ifndef __COMPONENT_nRF905_HEX_DUMP_H__
+#define __COMPONENT_nRF905_HEX_DUMP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace nrf905 {
+
+#define HEX_DUMP_LINE 32  // Bytes per logged line
+
+/* Logs a binary blob as "<prefix>: begin", fixed width hex lines and "<prefix>: end"
+ *
+ * For buffers that are decoded off-device (tools/); write() can be called any number of times in between.
+ */
+class HexDump {
+ public:
+  HexDump(const char *const pTag, const char *const pPrefix) : _tag(pTag), _prefix(pPrefix) {
+    ESP_LOGI(this->_tag, "%s: begin", this->_prefix);
+  }
+
+  void write(const uint8_t *const pData, const size_t dataLength) {
+    for (size_t i = 0; i < dataLength; ++i) {
+      (void) snprintf(&this->_line[this->_lineLength], sizeof(this->_line) - this->_lineLength, "%02X", pData[i]);
+      this->_lineLength += 2;
+      if (this->_lineLength == (2 * HEX_DUMP_LINE)) {
+        this->flush();
+      }
+    }
+  }
+
+  void end(void) {
+    this->flush();
+    ESP_LOGI(this->_tag, "%s: end", this->_prefix);
+  }
+
+ protected:
+  void flush(void) {
+    if (this->_lineLength > 0) {
+      ESP_LOGI(this->_tag, "%s: %s", this->_prefix, this->_line);
+      this->_lineLength = 0;
+    }
+  }
+
+  const char *_tag;
+  const char *_prefix;
+  char _line[(2 * HEX_DUMP_LINE) + 1];
+  size_t _lineLength{0};
+};
+
+}  // namespace nrf905
+}  // namespace esphome
+
+#endif /* __COMPONENT_nRF905_HEX_DUMP_H__ */
@@ -1,25 +1,69 @@
 #include "nRF905.h"
+#include "hex_dump.h"
 #include "esphome/core/log.h"
 
 #include <string.h>
 
-#define CHECK_REG_WRITE true
-
 namespace esphome {
 namespace nrf905 {
 
 static const char *TAG = "nRF905";
 
+void IRAM_ATTR nRF905Store::gpio_intr_dr(nRF905Store *arg) {
+  arg->dr_event = true;
+#ifdef NRF905_RADIO_TASK
+  arg->notify();
+#endif
+}
+
+void IRAM_ATTR nRF905Store::gpio_intr_am(nRF905Store *arg) {
+  arg->am_event = true;
+#ifdef NRF905_RADIO_TASK
+  arg->notify();
+#endif
+}
+
+#ifdef USE_ESP32
+void IRAM_ATTR nRF905Store::notify(void) {
+  BaseType_t woken = pdFALSE;
+
+  if (this->task != NULL) {
+    vTaskNotifyGiveFromISR(this->task, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+#endif
+
+#ifdef USE_HOST
+void nRF905Store::notify(void) {
+  if (this->wake != NULL) {
+    this->wake->notify();
+  }
+}
+#endif
+
 nRF905::nRF905(void) {}
 
+#ifdef USE_HOST
+nRF905::~nRF905() {
+  if (this->_thread.joinable() == true) {
+    this->_threadStop = true;
+    this->_wake.notify();
+    this->_thread.join();
+  }
+  delete[] this->_trace;
+}
+#endif
+
 void nRF905::setup() {
-  Config config;
+  uint32_t txAddress;
 
   ESP_LOGD(TAG, "Start nRF905 init");
 
   this->spi_setup();
   if (this->_gpio_pin_am != NULL) {
     this->_gpio_pin_am->setup();
+    this->_gpio_pin_am->attach_interrupt(nRF905Store::gpio_intr_am, &this->_store, gpio::INTERRUPT_ANY_EDGE);
   }
   if (this->_gpio_pin_cd != NULL) {
     this->_gpio_pin_cd->setup();
@@ -27,13 +71,22 @@ void nRF905::setup() {
   this->_gpio_pin_ce->setup();
   if (this->_gpio_pin_dr != NULL) {
     this->_gpio_pin_dr->setup();
+    this->_gpio_pin_dr->attach_interrupt(nRF905Store::gpio_intr_dr, &this->_store, gpio::INTERRUPT_ANY_EDGE);
   }
   this->_gpio_pin_pwr->setup();
   this->_gpio_pin_txen->setup();
 
+  if (this->_traceSize > 0) {
+    this->_trace = new TraceRecord[this->_traceSize];
+  }
+
+  this->_modeTimeStart = micros();
   this->setMode(PowerDown);
 
+  // Seed the register and TX address shadows. Nothing is written here: the user of the radio applies its own
+  // config, starting from the defaults below, and only what differs from the radio content goes over the bus.
   this->readConfigRegisters();
+  this->readTxAddress(&txAddress);
 
   this->_config.band = true;
   this->_config.channel = 118;
@@ -59,13 +112,29 @@ void nRF905::setup() {
   this->_config.clkOutFrequency = ClkOut500000;
   this->_config.clkOutEnable = false;
 
-  // Write config back
-  this->writeConfigRegisters();
-  this->writeTxAddress(0x89816EA9);
+  if (this->_spiSelfTest == true) {
+    this->spiSelfTest();
+  }
 
   // Return to idle
   this->setMode(Idle);
 
+  // Also keeps the micros() based accounting clear of its wrap-around
+  this->set_interval("mode_time", MODE_TIME_INTERVAL, [this]() {
+    for (uint8_t mode = 0; mode < ModeNrOf; ++mode) {
+      if (this->_modeTimeSensor[mode] != NULL) {
+        this->_modeTimeSensor[mode]->publish_state(this->getModeTime((Mode) mode) / 1000.0f);
+      }
+    }
+  });
+
+  if ((this->_radioTask == true) && (this->_gpio_pin_dr == NULL)) {
+    // Polling the status over SPI at the task period costs a thousand transactions a second; the main loop backs off
+    ESP_LOGW(TAG, "Radio task needs the DR pin, running from the main loop");
+  } else if (this->_radioTask == true) {
+    this->startTask();
+  }
+
   ESP_LOGD(TAG, "nRF905 Setup complete");
 }
 
@@ -85,59 +154,155 @@ void nRF905::dump_config() {
   LOG_PIN("  CE Pin:", this->_gpio_pin_ce);
   LOG_PIN("  PWR Pin:", this->_gpio_pin_pwr);
   LOG_PIN("  TXEN Pin:", this->_gpio_pin_txen);
+  ESP_LOGCONFIG(TAG, "  Register verify: %s",
+                this->_verifyPolicy == VerifyNone ? "none" : (this->_verifyPolicy == VerifyFull ? "full" : "changed"));
+  ESP_LOGCONFIG(TAG, "  SPI data rate: %u kHz", this->data_rate_ / 1000);
+  if (this->_spiSelfTest == true) {
+    ESP_LOGCONFIG(TAG, "  SPI self-test: %u transfers/s, %u errors", this->_selfTestRate, this->_selfTestErrors);
+  }
+  ESP_LOGCONFIG(TAG, "  SPI bus: %u transactions, %u bytes", this->_spiStats.transactions, this->_spiStats.bytes);
+  ESP_LOGCONFIG(TAG, "  SPI trace: %u/%u records", this->_traceCount, this->_traceSize);
+  ESP_LOGCONFIG(TAG, "  Status: %s", this->_gpio_pin_dr != NULL ? "interrupt (DR/AM pins)" : "polling (SPI)");
+  ESP_LOGCONFIG(TAG, "  Radio task: %s", this->taskRunning() ? "running" : "off");
+  if (this->taskRunning() == true) {
+    ESP_LOGCONFIG(TAG, "  Queue overflows: %u commands, %u events", this->_commandQueue.getOverflows(),
+                  this->_eventQueue.getOverflows());
+  }
+  ESP_LOGCONFIG(TAG, "  RX frames: %u received, %u queue overflows, %u invalid", this->_rxStats.frames,
+                this->_rxQueue.getOverflows(), this->_rxStats.invalid);
+  ESP_LOGCONFIG(TAG, "  TX timeouts: %u", this->_txTimeouts);
+  ESP_LOGCONFIG(TAG, "  Mode time: power down %u, idle %u, receive %u, transmit %u ms", this->getModeTime(PowerDown),
+                this->getModeTime(Idle), this->getModeTime(Receive), this->getModeTime(Transmit));
+  LOG_SENSOR("  ", "Power Down Time", this->_modeTimeSensor[PowerDown]);
+  LOG_SENSOR("  ", "Idle Time", this->_modeTimeSensor[Idle]);
+  LOG_SENSOR("  ", "Receive Time", this->_modeTimeSensor[Receive]);
+  LOG_SENSOR("  ", "Transmit Time", this->_modeTimeSensor[Transmit]);
 }
 
 void nRF905::loop() {
-  static uint8_t lastState = 0x00;
-  static bool addrMatch;
-  uint8_t buffer[NRF905_MAX_FRAMESIZE];
+  if (this->taskRunning() == true) {
+    // The radio task does the work; hand its results to the callbacks
+    this->dispatchEvents();
+  } else {
+    this->service();
+  }
+
+  if (this->onRxComplete != NULL) {
+    this->dispatchRxFrames();
+  }
+}
 
-  uint8_t state = this->readStatus() & ((1 << NRF905_STATUS_DR) | (1 << NRF905_STATUS_AM));
-  if (lastState != state) {
-    ESP_LOGV(TAG, "State change: 0x%02X -> 0x%02X", lastState, state);
+void nRF905::service(void) {
+  uint8_t state;
+
+  // The radio never reported the frame sent; don't hold the protocol layer forever
+  if ((this->txState != TxIdle) && ((millis() - this->txStartTime) > MAX_TRANSMIT_TIME)) {
+    ESP_LOGW(TAG, "TX timeout in state %u", this->txState);
+    ++this->_txTimeouts;
+    this->txComplete();
+  }
+
+  // Power-up and hardware retransmit burst run on time, not on DR
+  if ((this->txState != TxIdle) && (this->txState != TxSending) && ((int32_t) (micros() - this->txDeadline) >= 0)) {
+    if (this->txState == TxPowerUp) {
+      this->txState = TxSending;
+      this->setMode(Transmit);
+    } else if (this->txState == TxPulse) {
+      this->txState = TxSending;
+      this->setCe(true);
+    } else if (this->txState == TxBurst) {
+      // Drop TRX_CE in the last frame; with TX_EN still up the radio completes it and stops. Late loops shift the
+      // drop, so give it a whole frame.
+      this->setCe(false);
+      this->txState = TxStop;
+      this->txDeadline = micros() + this->frameAirTime() + 100;
+    } else {
+      this->txComplete();
+    }
+  }
+
+  // Between the deadlines of a power-up, CE pulse or burst DR/AM carry nothing to act on
+  if ((this->txState != TxIdle) && (this->txState != TxSending)) {
+    return;
+  }
+
+  if (this->_gpio_pin_dr != NULL) {
+    // Interrupt mode; only look at the radio when DR or AM had an edge
+    if ((this->_store.dr_event == false) && (this->_store.am_event == false)) {
+      return;
+    }
+    this->_store.dr_event = false;
+    this->_store.am_event = false;
+
+    state = this->readPinStatus();
+  } else {
+    if (this->statusPollDue() == false) {
+      return;
+    }
+
+    state = this->pollStatus();
+  }
+  state &= ((1 << NRF905_STATUS_DR) | (1 << NRF905_STATUS_AM));
+  if (this->_lastState != state) {
+    ESP_LOGV(TAG, "State change: 0x%02X -> 0x%02X", this->_lastState, state);
     if (state == ((1 << NRF905_STATUS_DR) | (1 << NRF905_STATUS_AM))) {
-      addrMatch = false;
+      this->_addrMatch = false;
 
-      // Read data
-      this->readRxPayload(buffer, NRF905_MAX_FRAMESIZE);
-      ESP_LOGV(TAG, "RX Complete: %s", hexArrayToStr(buffer, NRF905_MAX_FRAMESIZE));
+      this->receiveFrame();
 
-      if (this->onRxComplete != NULL) {
-        this->onRxComplete(buffer, NRF905_MAX_FRAMESIZE);
-      }
+      // Reading the payload cleared DR/AM; the next frame is a change again, even when it arrives before the
+      // next look at the status
+      state = 0x00;
     } else if (state == (1 << NRF905_STATUS_DR)) {
-      addrMatch = false;
-
-      // ESP_LOGD(TAG, "TX Ready; retransmits: %u", this->retransmitCounter);
-      // if (this->retransmitCounter > 0) {
-      //   --this->retransmitCounter;
-      // } else {
-      this->setMode(this->nextMode);
+      this->_addrMatch = false;
 
-      if (this->onTxReady != NULL) {
-        this->onTxReady();
+      this->txFrameDone();
+      if (this->txState == TxPulse) {
+        // The TRX_CE pulse clears DR; the DR of the next frame is a change again, even when the next look at the
+        // status comes after it
+        state = 0x00;
       }
-      // }
     } else if (state == (1 << NRF905_STATUS_AM)) {
-      addrMatch = true;
+      this->_addrMatch = true;
       ESP_LOGD(TAG, "Addr match");
 
       // if (onAddrMatch != NULL)
       //   onAddrMatch(this);
-    } else if (state == 0 && addrMatch) {
-      addrMatch = false;
+    } else if (state == 0 && this->_addrMatch) {
+      this->_addrMatch = false;
+      ++this->_rxStats.invalid;
       ESP_LOGD(TAG, "Rx Invalid");
       // if (onRxInvalid != NULL)
       //   onRxInvalid(this);
     }
 
-    lastState = state;
+    this->_lastState = state;
   }
 
   // _drPrev = _drNew;
 }
 
 void nRF905::setMode(const Mode mode) {
+  RadioCommand command;
+
+  if (this->deferToTask() == true) {
+    // The main loop asks for its mode every pass; only a change is worth a command
+    if (mode == this->_loopMode) {
+      return;
+    }
+    command.type = CommandSetMode;
+    command.mode = mode;
+    if (this->pushCommand(command) == true) {
+      this->_loopMode = mode;
+    }
+    return;
+  }
+
+  if (mode != this->_mode) {
+    this->accountModeTime();
+  }
+  this->traceRecord(TraceMode, mode, 0, this->_mode);
+
   // Set power
   switch (mode) {
     case PowerDown:
@@ -172,15 +337,137 @@ void nRF905::setMode(const Mode mode) {
       break;
   }
 
+  // DR/AM mean something else after a mode change, a status captured before it is stale
+  if (mode != this->_mode) {
+    this->_statusValid = false;
+  }
+
+  // In Receive/Transmit DR/AM can change any moment; poll at full rate again
+  if ((mode == Receive) || (mode == Transmit)) {
+    this->_pollInterval = 0;
+  }
+
   this->_mode = mode;
 }
 
+// TRX_CE alone, within a transmission; TX_EN and PWR_UP stay, so a frame on air is completed
+void nRF905::setCe(const bool level) {
+  this->_gpio_pin_ce->digital_write(level);
+
+  // Dropping TRX_CE clears DR; a status captured before is stale
+  this->_statusValid = false;
+}
+
+// End of a standby excursion for a register or payload access
+void nRF905::restoreMode(const Mode mode) {
+  // Nothing is received or sent in standby, so the status the transfers in between clocked out still holds
+  // once back in Receive or PowerDown; DR/AM mean something else in Transmit
+  const bool keepStatus =
+      (this->_statusValid == true) && (this->_mode == Idle) && (this->_statusMode == Idle) && (mode != Transmit);
+
+  this->setMode(mode);
+  if (keepStatus == true) {
+    this->_statusValid = true;
+    this->_statusMode = mode;
+  }
+}
+
+void nRF905::accountModeTime(void) {
+  const uint32_t now = micros();
+
+  this->_modeTime[this->_mode] += now - this->_modeTimeStart;
+  this->_modeTimeStart = now;
+}
+
+uint32_t nRF905::getModeTime(const Mode mode) {
+  // The radio task accounts on every wake-up and publishes the result
+  if (this->deferToTask() == true) {
+    return this->_taskModeTime[mode];
+  }
+  this->accountModeTime();
+
+  return this->_modeTime[mode] / 1000;  // ms
+}
+
+Config nRF905::getConfig(void) {
+  // The task may be writing _config right now
+  return (this->deferToTask() == true) ? this->_loopConfig : this->_config;
+}
+
 void nRF905::updateConfig(Config *config, uint8_t *const pStatus) {
+  RadioCommand command;
+
+  if (this->deferToTask() == true) {
+    this->_loopConfig = *config;
+    command.type = CommandConfig;
+    command.config = *config;
+    this->pushCommand(command);
+    if (pStatus != NULL) {
+      *pStatus = this->_taskStatus;
+    }
+    return;
+  }
+
   this->_config = *config;
 
   this->writeConfigRegisters(pStatus);
 }
 
+void nRF905::setChannelConfig(const uint16_t channel, const bool band, const int8_t txPower,
+                              uint8_t *const pStatus) {
+  RadioCommand command;
+  Mode mode;
+  uint8_t buffer[2];
+
+  if (this->deferToTask() == true) {
+    this->_loopConfig.channel = channel;
+    this->_loopConfig.band = band;
+    this->_loopConfig.tx_power = txPower;
+    this->_loopConfig.frequency = ((422400000 + (channel * 100000)) * (band ? 2 : 1));  // internal
+    command.type = CommandChannelConfig;
+    command.config = this->_loopConfig;
+    this->pushCommand(command);
+    if (pStatus != NULL) {
+      *pStatus = this->_taskStatus;
+    }
+    return;
+  }
+
+  // CHANNEL_CONFIG: 1000 PA_PWR[1:0] HFREQ_PLL CH_NO[8], CH_NO[7:0]; same layout as config bytes 0-1
+  buffer[0] = NRF905_COMMAND_CHANNEL_CONFIG | this->encodeTxPower(txPower) | (band ? 0x02 : 0x00) |
+              ((channel >> 8) & 0x01);
+  buffer[1] = channel & 0xFF;
+
+  if ((this->_registersValid == true) && (this->_registers[0] == buffer[1]) &&
+      ((this->_registers[1] & 0x0F) == (buffer[0] & 0x0F))) {
+    if (pStatus != NULL) {
+      *pStatus = this->_status;
+    }
+    return;
+  }
+
+  ESP_LOGV(TAG, "Set channel %u band %s power %d dBm", channel, band ? "868" : "434", txPower);
+
+  mode = this->_mode;
+  this->setMode(Idle);
+
+  this->_registers[0] = buffer[1];
+  this->_registers[1] = (this->_registers[1] & 0xF0) | (buffer[0] & 0x0F);
+
+  this->spiTransfer(buffer, sizeof(buffer));
+  if (pStatus != NULL) {
+    *pStatus = buffer[0];
+  }
+
+  // Keep config in sync with the radio
+  this->_config.channel = channel;
+  this->_config.band = band;
+  this->_config.tx_power = txPower;
+  this->_config.frequency = ((422400000 + (channel * 100000)) * (band ? 2 : 1));  // internal
+
+  this->restoreMode(mode);
+}
+
 void nRF905::readConfigRegisters(uint8_t *const pStatus) {
   Mode mode;
   ConfigBuffer buffer;
@@ -203,61 +490,160 @@ void nRF905::readConfigRegisters(uint8_t *const pStatus) {
   (void) memset(&this->_config, 0, sizeof(Config));
   this->decodeConfigRegisters(&buffer, &this->_config);
 
+  // Radio content is known now
+  (void) memcpy(this->_registers, buffer.data, NRF905_REGISTER_COUNT);
+  this->_registersValid = true;
+
   // Restore mode
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
 void nRF905::writeConfigRegisters(uint8_t *const pStatus) {
   Mode mode;
   ConfigBuffer buffer;
-#if CHECK_REG_WRITE
-  uint8_t writeData[NRF905_REGISTER_COUNT];
-#endif
+  uint8_t first = 0;
+  uint8_t last = NRF905_REGISTER_COUNT - 1;
+  uint8_t length;
+
+  // Create data
+  this->encodeConfigRegisters(&this->_config, &buffer);
+
+  // Only write the range that differs from the shadow registers
+  if (this->_registersValid == true) {
+    while ((first < NRF905_REGISTER_COUNT) && (buffer.data[first] == this->_registers[first])) {
+      ++first;
+    }
+    if (first == NRF905_REGISTER_COUNT) {
+      ESP_LOGVV(TAG, "Config unchanged");
+      if (pStatus != NULL) {
+        *pStatus = this->_status;
+      }
+      return;
+    }
+    while (buffer.data[last] == this->_registers[last]) {
+      --last;
+    }
+  }
+  length = last - first + 1;
 
   mode = this->_mode;
   this->setMode(Idle);
 
   this->printConfig(&this->_config);
 
-  // Create data
-  buffer.command = NRF905_COMMAND_W_CONFIG;
-  this->encodeConfigRegisters(&this->_config, &buffer);
+  // W_CONFIG takes the start byte in its lower nibble, move the range right behind the command
+  buffer.command = NRF905_COMMAND_W_CONFIG | first;
+  (void) memmove(buffer.data, &buffer.data[first], length);
 
-  ESP_LOGV(TAG, "Write config data: %s", hexArrayToStr(buffer.data, NRF905_REGISTER_COUNT));
-#if CHECK_REG_WRITE
-  (void) memcpy(writeData, buffer.data, NRF905_REGISTER_COUNT);
-#endif
+  ESP_LOGV(TAG, "Write config data @%u: %s", first, hexArrayToStr(buffer.data, length));
+  (void) memcpy(&this->_registers[first], buffer.data, length);
+  this->_registersValid = true;
 
-  this->spiTransfer((uint8_t *) &buffer, sizeof(ConfigBuffer));
+  this->spiTransfer((uint8_t *) &buffer, 1 + length);
+
+  if (pStatus != NULL) {
+    *pStatus = buffer.command;
+  }
 
-#if CHECK_REG_WRITE
-  // Check config write by reading config back and compare
-  {
-    ConfigBuffer bufferRead;
+  switch (this->_verifyPolicy) {
+    case VerifyChanged:
+      this->verifyConfigRegisters(first, length);
+      break;
 
-    bufferRead.command = NRF905_COMMAND_R_CONFIG;
-    (void) memset(bufferRead.data, 0, NRF905_REGISTER_COUNT);
+    case VerifyFull:
+      this->verifyConfigRegisters(0, NRF905_REGISTER_COUNT);
+      break;
 
-    this->spiTransfer((uint8_t *) &bufferRead, sizeof(ConfigBuffer));
-    if (memcmp((void *) writeData, (void *) bufferRead.data, NRF905_REGISTER_COUNT) != 0) {
-      ESP_LOGE(TAG, "Config write failed");
-    } else {
-      ESP_LOGV(TAG, "Write config OK");
+    default:
+      break;
+  }
+
+  // Restore mode
+  this->restoreMode(mode);
+}
+
+bool nRF905::verifyConfigRegisters(const uint8_t offset, const uint8_t length) {
+  ConfigBuffer buffer;
+
+  // R_CONFIG takes the start byte in its lower nibble as well
+  buffer.command = NRF905_COMMAND_R_CONFIG | offset;
+  (void) memset(buffer.data, 0, NRF905_REGISTER_COUNT);
+
+  this->spiTransfer((uint8_t *) &buffer, 1 + length);
+  if (memcmp((void *) &this->_registers[offset], (void *) buffer.data, length) != 0) {
+    ESP_LOGE(TAG, "Config write failed");
+
+    // Force a full write next time
+    this->_registersValid = false;
+    return false;
+  }
+
+  ESP_LOGV(TAG, "Write config OK");
+  return true;
+}
+
+void nRF905::spiSelfTest(void) {
+  Mode mode;
+  ConfigBuffer buffer;
+  uint32_t start;
+  uint32_t elapsed;
+
+  mode = this->_mode;
+  this->setMode(Idle);
+
+  // Time config write/read-back round trips of the current register image
+  this->_selfTestErrors = 0;
+  start = micros();
+  for (uint16_t i = 0; i < SPI_SELF_TEST_ROUNDS; ++i) {
+    buffer.command = NRF905_COMMAND_W_CONFIG;
+    (void) memcpy(buffer.data, this->_registers, NRF905_REGISTER_COUNT);
+    this->spiTransfer((uint8_t *) &buffer, sizeof(ConfigBuffer));
+
+    buffer.command = NRF905_COMMAND_R_CONFIG;
+    (void) memset(buffer.data, 0, NRF905_REGISTER_COUNT);
+    this->spiTransfer((uint8_t *) &buffer, sizeof(ConfigBuffer));
+
+    if (memcmp(this->_registers, buffer.data, NRF905_REGISTER_COUNT) != 0) {
+      ++this->_selfTestErrors;
     }
   }
-#endif
+  elapsed = micros() - start;
 
-  if (pStatus != NULL) {
-    *pStatus = buffer.command;
+  this->_selfTestRate = (elapsed > 0) ? ((2 * SPI_SELF_TEST_ROUNDS * 1000000ULL) / elapsed) : 0;
+
+  if (this->_selfTestErrors > 0) {
+    ESP_LOGE(TAG, "SPI self-test at %u kHz: %u of %u round trips failed", this->data_rate_ / 1000,
+             this->_selfTestErrors, SPI_SELF_TEST_ROUNDS);
+    this->status_set_warning();
+  } else {
+    ESP_LOGI(TAG, "SPI self-test at %u kHz: %u transfers/s, no errors", this->data_rate_ / 1000,
+             this->_selfTestRate);
   }
 
-  // Restore mode
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
 void nRF905::writeTxAddress(const uint32_t txAddress, uint8_t *const pStatus) {
   Mode mode;
   AddressBuffer buffer;
+  RadioCommand command;
+
+  if (this->deferToTask() == true) {
+    command.type = CommandTxAddress;
+    command.value = txAddress;
+    this->pushCommand(command);
+    if (pStatus != NULL) {
+      *pStatus = this->_taskStatus;
+    }
+    return;
+  }
+
+  if ((this->_txAddressValid == true) && (this->_txAddress == txAddress)) {
+    if (pStatus != NULL) {
+      *pStatus = this->_status;
+    }
+    return;
+  }
 
   ESP_LOGD(TAG, "Set TX Address: 0x%08X", txAddress);
 
@@ -272,12 +658,15 @@ void nRF905::writeTxAddress(const uint32_t txAddress, uint8_t *const pStatus) {
 
   this->spiTransfer((uint8_t *) &buffer, sizeof(AddressBuffer));
 
+  this->_txAddress = txAddress;
+  this->_txAddressValid = true;
+
   if (pStatus != NULL) {
     *pStatus = buffer.command;
   }
 
   // Restore mode
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
 void nRF905::readTxAddress(uint32_t *pTxAddress, uint8_t *const pStatus) {
@@ -299,16 +688,19 @@ void nRF905::readTxAddress(uint32_t *pTxAddress, uint8_t *const pStatus) {
 
   ESP_LOGD(TAG, "Got TX Address: 0x%08X", *pTxAddress);
 
+  this->_txAddress = *pTxAddress;
+  this->_txAddressValid = true;
+
   if (pStatus != NULL) {
     *pStatus = buffer.command;
   }
 
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
 void nRF905::readTxPayload(uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus) {
   Mode mode;
-  Buffer buffer;
+  uint8_t status;
 
   if (pData == NULL) {
     ESP_LOGE(TAG, "Read TX payload data pointer invalid");
@@ -319,77 +711,101 @@ void nRF905::readTxPayload(uint8_t *const pData, const uint8_t dataLength, uint8
     return;
   }
 
-  buffer.command = NRF905_COMMAND_R_TX_PAYLOAD;
-  (void) memset(buffer.payload, 0, NRF905_MAX_FRAMESIZE);
-
   mode = this->_mode;
   this->setMode(Idle);
 
-  this->spiTransfer((uint8_t *) &buffer, sizeof(Buffer));
-  (void) memcpy(pData, buffer.payload, dataLength);
+  status = this->spiRead(NRF905_COMMAND_R_TX_PAYLOAD, pData, dataLength);
 
   if (pStatus != NULL) {
-    *pStatus = buffer.command;
+    *pStatus = status;
   }
 
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
 void nRF905::writeTxPayload(const uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus) {
   Mode mode;
-  Buffer buffer;
+  uint8_t status;
+  RadioCommand command;
+  const uint8_t width = this->txPayloadWidth();
 
   if (pData == NULL) {
     ESP_LOGE(TAG, "Write data pointer invalid");
     return;
   }
-  if (dataLength > NRF905_MAX_FRAMESIZE) {
+  if (dataLength > width) {
     ESP_LOGE(TAG, "Write data length invalid");
     return;
   }
 
-  ESP_LOGV(TAG, "Read config data: %s", hexArrayToStr(pData, dataLength));
-
-  // Clear buffer payload
-  (void) memset(buffer.payload, 0, NRF905_MAX_FRAMESIZE);
+  if (this->deferToTask() == true) {
+    command.type = CommandTxPayload;
+    command.length = dataLength;
+    (void) memcpy(command.payload, pData, dataLength);
+    this->pushCommand(command);
+    if (pStatus != NULL) {
+      *pStatus = this->_taskStatus;
+    }
+    return;
+  }
 
-  buffer.command = NRF905_COMMAND_W_TX_PAYLOAD;
-  (void) memcpy(buffer.payload, (uint8_t *) pData, dataLength);
+  ESP_LOGV(TAG, "Write TX payload: %s", hexArrayToStr(pData, dataLength));
 
   mode = this->_mode;
   this->setMode(Idle);
 
-  this->spiTransfer((uint8_t *) &buffer, sizeof(Buffer));
+  // Only clock out the configured payload width, zero padded
+  this->enable();
+  status = this->transfer_byte(NRF905_COMMAND_W_TX_PAYLOAD);
+  this->write_array(pData, dataLength);
+  for (uint8_t i = dataLength; i < width; ++i) {
+    this->write_byte(0x00);
+  }
+  this->disable();
+  this->spiComplete(NRF905_COMMAND_W_TX_PAYLOAD, status, 1 + width);
+
   if (pStatus != NULL) {
-    *pStatus = buffer.command;
+    *pStatus = status;
   }
 
-  this->setMode(mode);
+  this->restoreMode(mode);
 }
 
-void nRF905::readRxPayload(uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus) {
-  Buffer buffer;
+uint8_t nRF905::readRxPayload(uint8_t *const pData, uint8_t *const pStatus) {
+  uint8_t status;
+  const uint8_t width = this->rxPayloadWidth();
 
-  if (pData == NULL) {
-    ESP_LOGE(TAG, "Read RX data pointer invalid");
-    return;
-  }
-  if (dataLength > NRF905_MAX_FRAMESIZE) {
-    ESP_LOGE(TAG, "Read RX data length invalid");
-    return;
+  // Only the configured payload width
+  status = this->spiRead(NRF905_COMMAND_R_RX_PAYLOAD, pData, width);
+
+  // The radio clears DR/AM once the payload is read; the status clocked out before that is stale
+  this->_status &= ~((1 << NRF905_STATUS_DR) | (1 << NRF905_STATUS_AM));
+
+  // Return status if needed
+  if (pStatus != NULL) {
+    *pStatus = status;
   }
 
-  buffer.command = NRF905_COMMAND_R_RX_PAYLOAD;
-  (void) memset(buffer.payload, 0, NRF905_MAX_FRAMESIZE);
+  return width;
+}
+
+uint8_t nRF905::rxPayloadWidth(void) {
+  const Config *const pConfig = (this->deferToTask() == true) ? &this->_loopConfig : &this->_config;
 
-  this->spiTransfer((uint8_t *) &buffer, sizeof(Buffer));
+  if ((pConfig->rx_payload_width == 0) || (pConfig->rx_payload_width > NRF905_MAX_FRAMESIZE)) {
+    return NRF905_MAX_FRAMESIZE;
+  }
+  return pConfig->rx_payload_width;
+}
 
-  (void) memcpy(pData, buffer.payload, dataLength);
+uint8_t nRF905::txPayloadWidth(void) {
+  // writeTxPayload() checks the length before it defers; the main loop's copy of the config has the same widths
+  const Config *const pConfig = (this->deferToTask() == true) ? &this->_loopConfig : &this->_config;
 
-  // Return status if needed
-  if (pStatus != NULL) {
-    *pStatus = buffer.command;
+  if ((pConfig->tx_payload_width == 0) || (pConfig->tx_payload_width > NRF905_MAX_FRAMESIZE)) {
+    return NRF905_MAX_FRAMESIZE;
   }
+  return pConfig->tx_payload_width;
 }
 
 void nRF905::decodeConfigRegisters(const ConfigBuffer *const pBuffer, Config *const pConfig) {
@@ -433,35 +849,30 @@ void nRF905::decodeConfigRegisters(const ConfigBuffer *const pBuffer, Config *co
   }
 }
 
-void nRF905::encodeConfigRegisters(const Config *const pConfig, ConfigBuffer *const pBuffer) {
-  uint8_t tx_power;
-
-  switch (pConfig->tx_power) {
+uint8_t nRF905::encodeTxPower(const int8_t txPower) {
+  switch (txPower) {
     case -10:
-      tx_power = 0x00;
-      break;
+      return 0x00;
 
     case -2:
-      tx_power = 0x04;
-      break;
+      return 0x04;
 
     case 6:
-      tx_power = 0x08;
-      break;
+      return 0x08;
 
     case 10:
-      tx_power = 0x0C;
-      break;
+      return 0x0C;
 
     default:
-      tx_power = 0x0C;
-      break;
+      return 0x0C;
   }
+}
 
+void nRF905::encodeConfigRegisters(const Config *const pConfig, ConfigBuffer *const pBuffer) {
   pBuffer->data[0] = (pConfig->channel & 0xFF);
   pBuffer->data[1] = (pConfig->channel >> 8) & 0x01;
   pBuffer->data[1] |= (pConfig->band ? 0x02 : 0x00);
-  pBuffer->data[1] |= tx_power;
+  pBuffer->data[1] |= this->encodeTxPower(pConfig->tx_power);
   pBuffer->data[1] |= (pConfig->rx_power == PowerReduced ? 0x10 : 0x00);
   pBuffer->data[1] |= (pConfig->auto_retransmit ? 0x20 : 0x00);
   pBuffer->data[2] = (pConfig->rx_address_width & 0x07);
@@ -533,31 +944,307 @@ bool nRF905::airwayBusy(void) {
   return busy;
 }
 
-void nRF905::startTx(const uint32_t retransmit, const Mode nextMode) {
-  bool update = false;
-  if (this->_mode == PowerDown) {
+void nRF905::startTx(const uint32_t frames, const Mode nextMode) {
+  const bool powerUp = this->_mode == PowerDown;
+  RadioCommand command;
+
+  if (this->deferToTask() == true) {
+    command.type = CommandStartTx;
+    command.value = frames;
+    command.mode = nextMode;
+    if (this->pushCommand(command) == true) {
+      this->_loopMode = nextMode;
+    }
+    return;
+  }
+
+  if (powerUp == true) {
+    // Registers and payload can be written during power-up; loop() starts the transmission once settled
     this->setMode(Idle);
-    delay(3);  // Delay is needed to the radio has time to power-up and see the standby/TX pins pulse
+    this->txDeadline = micros() + POWER_UP_TIME;
   }
 
   // Update counters
-  // this->retransmitCounter = retransmit;
+  this->retransmitCounter = (frames > 0) ? frames : 1;
   this->nextMode = nextMode;
+  this->txStartTime = millis();
 
-  // Set or clear retransmit flag
-  // if ((this->_config.auto_retransmit == false) && (retransmit > 0)) {
-  //   this->_config.auto_retransmit = true;
-  //   update = true;
-  // } else if ((this->_config.auto_retransmit == true) && (retransmit == 0)) {
-  this->_config.auto_retransmit = false;
-  update = true;
-  // }
-  if (update == true) {
-    this->writeConfigRegisters();
+  // The burst stops on time and each frame on DR; don't let the main loop sleep through it
+  if (this->taskRunning() == false) {
+    this->_highFrequency.start();
   }
 
+  // Set or clear retransmit flag; only written when it toggles
+  this->_config.auto_retransmit = (this->_autoRetransmit == true) && (this->retransmitCounter > 1);
+  this->writeConfigRegisters();
+
   // Start transmit
-  this->setMode(Transmit);
+  if (powerUp == true) {
+    this->txState = TxPowerUp;
+  } else {
+    this->txState = TxSending;
+    this->setMode(Transmit);
+  }
+}
+
+void nRF905::txFrameDone(void) {
+  if (this->txState != TxSending) {
+    return;
+  }
+
+  ESP_LOGV(TAG, "TX Ready; frames left: %u", this->retransmitCounter - 1);
+  if (this->retransmitCounter > 1) {
+    if (this->_config.auto_retransmit == true) {
+      // Next frame is on air already; stop halfway through the last one
+      this->txState = TxBurst;
+      this->txDeadline = micros() + ((this->retransmitCounter - 2) * this->frameAirTime()) + (this->frameAirTime() / 2);
+    } else {
+      // Pulse TRX_CE again, the payload stays in the radio; service() raises it after CE_PULSE_TIME
+      --this->retransmitCounter;
+      this->setCe(false);
+      this->txState = TxPulse;
+      this->txDeadline = micros() + CE_PULSE_TIME;
+    }
+    return;
+  }
+
+  this->txComplete();
+}
+
+void nRF905::txComplete(void) {
+  RadioEvent event;
+
+  this->txState = TxIdle;
+  this->retransmitCounter = 0;
+  this->setMode(this->nextMode);
+  this->_highFrequency.stop();
+
+  if (this->taskRunning() == true) {
+    event.type = EventTxReady;
+    this->_eventQueue.push(event);
+  } else if (this->onTxReady != NULL) {
+    this->onTxReady(this->onTxReadyArg);
+  }
+}
+
+void nRF905::receiveFrame(void) {
+  RxFrame *const pFrame = this->_rxQueue.acquire();
+  uint8_t length;
+
+  if (pFrame == NULL) {
+    // Queue full; the payload still has to be read to clear DR
+    length = this->readRxPayload(this->_rxPayload);
+    ESP_LOGW(TAG, "RX queue full, frame dropped: %s", hexArrayToStr(this->_rxPayload, length));
+    return;
+  }
+
+  // Read straight into the queue slot
+  pFrame->length = this->readRxPayload(pFrame->payload);
+  pFrame->timeUs = micros();
+  pFrame->time = millis();
+  ESP_LOGV(TAG, "RX Complete: %s", hexArrayToStr(pFrame->payload, pFrame->length));
+
+  this->_rxQueue.commit();
+  ++this->_rxStats.frames;
+}
+
+void nRF905::dispatchRxFrames(void) {
+  const RxFrame *pFrame;
+
+  // Everything received since the last pass, in one go
+  while ((pFrame = this->_rxQueue.front()) != NULL) {
+    this->onRxComplete(this->onRxCompleteArg, pFrame->payload, pFrame->length);
+    this->_rxQueue.release();
+  }
+}
+
+RxStats nRF905::getRxStats(void) {
+  RxStats stats = this->_rxStats;
+
+  stats.overflows = this->_rxQueue.getOverflows();
+
+  return stats;
+}
+
+void nRF905::resetSpiStats(void) {
+  RadioCommand command;
+
+  if (this->deferToTask() == true) {
+    command.type = CommandResetSpiStats;
+    this->pushCommand(command);
+    return;
+  }
+
+  this->_spiStats = {0, 0};
+}
+
+bool nRF905::taskRunning(void) {
+#if defined(USE_ESP32)
+  return this->_task != NULL;
+#elif defined(USE_HOST)
+  return this->_thread.joinable();
+#else
+  return false;
+#endif
+}
+
+bool nRF905::deferToTask(void) {
+  // Only the radio task touches the radio once it runs; other callers queue their request
+#if defined(USE_ESP32)
+  return (this->_task != NULL) && (xTaskGetCurrentTaskHandle() != this->_task);
+#elif defined(USE_HOST)
+  return this->_thread.joinable() && (std::this_thread::get_id() != this->_thread.get_id());
+#else
+  return false;
+#endif
+}
+
+void nRF905::startTask(void) {
+  // From here on the main loop works on its own copy of the config and mode
+  this->_loopConfig = this->_config;
+  this->_loopMode = this->_mode;
+  this->accountModeTime();
+  this->publishTaskState();
+
+#if defined(USE_ESP32)
+  if (xTaskCreate(nRF905::radioTask, "nrf905", RADIO_TASK_STACK, this, RADIO_TASK_PRIORITY, &this->_task) == pdPASS) {
+    this->_store.task = this->_task;
+  } else {
+    ESP_LOGE(TAG, "Failed to start the radio task, running from the main loop");
+    this->_task = NULL;
+  }
+#elif defined(USE_HOST)
+  this->_store.wake = &this->_wake;
+  this->_thread = std::thread([this]() {
+    while (this->_threadStop == false) {
+      // Woken by the DR/AM interrupts and by commands; the timeout covers deadlines and status polling
+      this->_wake.wait(RADIO_TASK_PERIOD);
+      this->runTask();
+    }
+  });
+#else
+  ESP_LOGE(TAG, "No radio task on this platform, running from the main loop");
+#endif
+}
+
+bool nRF905::pushCommand(const RadioCommand &command) {
+  if (this->_commandQueue.push(command) == false) {
+    ESP_LOGW(TAG, "Command queue full, command %u dropped", command.type);
+    return false;
+  }
+#if defined(USE_ESP32)
+  xTaskNotifyGive(this->_task);
+#elif defined(USE_HOST)
+  this->_wake.notify();
+#endif
+
+  return true;
+}
+
+void nRF905::runCommand(const RadioCommand &command) {
+  Config config;
+
+  switch (command.type) {
+    case CommandSetMode:
+      this->setMode(command.mode);
+      break;
+
+    case CommandConfig:
+      config = command.config;
+      this->updateConfig(&config);
+      break;
+
+    case CommandTxAddress:
+      this->writeTxAddress(command.value);
+      break;
+
+    case CommandTxPayload:
+      this->writeTxPayload(command.payload, command.length);
+      break;
+
+    case CommandStartTx:
+      this->startTx(command.value, command.mode);
+      break;
+
+    case CommandChannelConfig:
+      this->setChannelConfig(command.config.channel, command.config.band, command.config.tx_power);
+      break;
+
+    case CommandResetSpiStats:
+      this->resetSpiStats();
+      break;
+
+    case CommandTraceMark:
+      this->traceMark(command.value);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void nRF905::dispatchEvents(void) {
+  RadioEvent event;
+
+  while (this->_eventQueue.pop(&event) == true) {
+    switch (event.type) {
+      case EventTxReady:
+        if (this->onTxReady != NULL) {
+          this->onTxReady(this->onTxReadyArg);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+void nRF905::runTask(void) {
+  RadioCommand command;
+
+  while (this->_commandQueue.pop(&command) == true) {
+    this->runCommand(command);
+  }
+  this->service();
+  this->accountModeTime();
+  this->publishTaskState();
+}
+
+// What the main loop may read of the task's state; the rest stays with the task
+void nRF905::publishTaskState(void) {
+  this->_taskStatus = this->_status;
+  for (uint8_t mode = 0; mode < ModeNrOf; ++mode) {
+    this->_taskModeTime[mode] = this->_modeTime[mode] / 1000;
+  }
+}
+
+#ifdef USE_ESP32
+void nRF905::radioTask(void *arg) {
+  nRF905 *const pThis = (nRF905 *) arg;
+  TickType_t period = pdMS_TO_TICKS(RADIO_TASK_PERIOD);
+
+  if (period == 0) {
+    period = 1;  // Never spin, whatever the tick rate
+  }
+
+  for (;;) {
+    // Woken by the DR/AM interrupts and by commands; the timeout covers deadlines and status polling
+    ulTaskNotifyTake(pdTRUE, period);
+    pThis->runTask();
+  }
+}
+#endif
+
+uint32_t nRF905::frameAirTime(void) {
+  // 10 bit preamble, address, payload and CRC at 50kbps (20us per bit)
+  uint32_t bits = 10 + (8 * (this->_config.tx_address_width + this->txPayloadWidth()));
+
+  if (this->_config.crc_enable == true) {
+    bits += this->_config.crc_bits;
+  }
+
+  return bits * 20;
 }
 
 uint8_t nRF905::readStatus(void) {
@@ -570,12 +1257,162 @@ uint8_t nRF905::readStatus(void) {
   return status;
 }
 
+uint8_t nRF905::pollStatus(void) {
+  // Every SPI command clocks out the status; reuse a recent one from the current mode instead of sending a NOP
+  if ((this->_statusValid == true) && (this->_statusMode == this->_mode) &&
+      ((micros() - this->_statusTime) < STATUS_MAX_AGE)) {
+    return this->_status;
+  }
+
+  return this->readStatus();
+}
+
+bool nRF905::statusPollDue(void) {
+  const uint32_t now = millis();
+
+  if ((this->_mode == Receive) || (this->_mode == Transmit)) {
+    return true;
+  }
+
+  // DR/AM can't change in Idle/PowerDown, back off polling exponentially
+  if ((now - this->_pollTime) < this->_pollInterval) {
+    return false;
+  }
+  this->_pollTime = now;
+
+  if (this->_pollInterval == 0) {
+    this->_pollInterval = 1;
+  } else if (this->_pollInterval < STATUS_POLL_BACKOFF_MAX) {
+    this->_pollInterval <<= 1;
+  }
+
+  return true;
+}
+
+uint8_t nRF905::readPinStatus(void) {
+  uint8_t status = 0;
+
+  if (this->_gpio_pin_am == NULL) {
+    // DR edge without AM pin, get the full status from the radio
+    return this->readStatus();
+  }
+
+  if (this->_gpio_pin_dr->digital_read() == true) {
+    status |= (1 << NRF905_STATUS_DR);
+  }
+  if (this->_gpio_pin_am->digital_read() == true) {
+    status |= (1 << NRF905_STATUS_AM);
+  }
+
+  return status;
+}
+
 void nRF905::spiTransfer(uint8_t *const data, const size_t length) {
+  const uint8_t command = data[0];  // Overwritten by the status byte
+
   this->enable();
 
   this->transfer_array(data, length);
 
   this->disable();
+
+  this->spiComplete(command, data[0], length);
+}
+
+uint8_t nRF905::spiRead(const uint8_t command, uint8_t *const data, const size_t length) {
+  uint8_t status;
+
+  this->enable();
+
+  status = this->transfer_byte(command);
+  this->read_array(data, length);
+
+  this->disable();
+
+  this->spiComplete(command, status, 1 + length);
+
+  return status;
+}
+
+void nRF905::spiComplete(const uint8_t command, const uint8_t status, const size_t length) {
+  // First byte out of every command is the status register
+  this->_status = status;
+  this->_statusTime = micros();
+  this->_statusMode = this->_mode;
+  this->_statusValid = true;
+
+  // Bus accounting
+  ++this->_spiStats.transactions;
+  this->_spiStats.bytes += length;
+
+  this->traceRecord(TraceSpi, command, length, status);
+}
+
+void nRF905::traceMark(const uint8_t tag) {
+  RadioCommand command;
+
+  // The task owns the trace; queued, the mark also lands between the transactions it belongs to
+  if (this->deferToTask() == true) {
+    command.type = CommandTraceMark;
+    command.value = tag;
+    this->pushCommand(command);
+    return;
+  }
+
+  this->traceRecord(TraceMark, tag, 0, 0);
+}
+
+void nRF905::traceRecord(const TraceKind kind, const uint8_t command, const uint8_t length, const uint8_t status) {
+  TraceRecord *pRecord;
+
+  if ((this->_trace == NULL) || (this->_tracePaused == true)) {
+    return;
+  }
+
+  pRecord = &this->_trace[this->_traceNext];
+  pRecord->time = micros();
+  pRecord->kind = kind;
+  pRecord->command = command;
+  pRecord->length = length;
+  pRecord->status = status;
+
+  this->_traceNext = (this->_traceNext + 1) % this->_traceSize;
+  if (this->_traceCount < this->_traceSize) {
+    ++this->_traceCount;
+  }
+}
+
+// Log the trace as hex lines; tools/spi_trace.py turns the log back into transactions
+void nRF905::dumpSpiTrace(void) {
+  const uint8_t header[8] = {'Z',
+                             'R',
+                             'F',
+                             'T',
+                             SPI_TRACE_VERSION,
+                             sizeof(TraceRecord),
+                             (uint8_t) (this->_traceCount & 0xFF),
+                             (uint8_t) (this->_traceCount >> 8)};
+  uint16_t first;
+
+  if (this->_trace == NULL) {
+    ESP_LOGW(TAG, "SPI trace disabled, set spi_trace_size");
+    return;
+  }
+
+  // With the radio task running a transaction may be recorded while pausing; that record can come out torn
+  this->_tracePaused = true;
+
+  // Oldest record first
+  first = (this->_traceNext + this->_traceSize - this->_traceCount) % this->_traceSize;
+
+  HexDump dump(TAG, "spi trace");
+  dump.write(header, sizeof(header));
+  for (uint16_t i = 0; i < this->_traceCount; ++i) {
+    dump.write((const uint8_t *) &this->_trace[(first + i) % this->_traceSize], sizeof(TraceRecord));
+  }
+  dump.end();
+
+  this->_tracePaused = false;
 }
 
 char *nRF905::hexArrayToStr(const uint8_t *const pData, const size_t dataLength) {
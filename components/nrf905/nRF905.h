@@ -5,13 +5,45 @@
 #include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
 #include "esphome/components/spi/spi.h"
+#include "esphome/components/sensor/sensor.h"
 #include "nRF905.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#ifdef USE_HOST
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// Radio task: a FreeRTOS task on ESP32, a std::thread on the host
+#if defined(USE_ESP32) || defined(USE_HOST)
+#define NRF905_RADIO_TASK
+#endif
 
 namespace esphome {
 namespace nrf905 {
 
-#define MAX_TRANSMIT_TIME 2000      // TODO figure out what timeout we want
+#define MAX_TRANSMIT_TIME 2000      // Give up on a transmission the radio never reports done (in ms)
 #define CARRIERDETECT_LED_DELAY 20  // On-board LED will light up for 20ms when data is received
+#define STATUS_MAX_AGE 1000         // Reuse the status byte of an SPI transfer for up to 1ms (in us)
+#define STATUS_POLL_BACKOFF_MAX 64  // Max status poll interval in Idle/PowerDown (in ms)
+#define SPI_SELF_TEST_ROUNDS 100    // Config write/read-back rounds of the boot SPI self-test
+#define POWER_UP_TIME 3000          // PowerDown to standby settle time (in us)
+#define CE_PULSE_TIME 10            // TRX_CE low between pulsed frames, datasheet minimum (in us)
+#define MODE_TIME_INTERVAL 60000    // Mode time sensor publish interval (in ms)
+#define RADIO_TASK_STACK 4096       // Radio task stack size (in bytes)
+#define RADIO_TASK_PRIORITY 5       // Above the main loop task, below WiFi
+#define RADIO_TASK_PERIOD 1         // Radio task wakes at least every 1ms for deadlines and status polling
+#define RADIO_QUEUE_SIZE 8          // Commands and events in flight between main loop and radio task
+#define RX_QUEUE_SIZE 8             // Received frames waiting for the consumer, one slot stays free
+#define SPI_TRACE_VERSION 1         // SPI trace dump format: "ZRFT", version, record size, record count (LE16), records
 
 /* nRF905 register sizes */
 #define NRF905_REGISTER_COUNT 10
@@ -37,7 +69,23 @@ typedef enum {
   Failure,
 } nRF905Cc;
 
-typedef enum { PowerDown, Idle, Receive, Transmit } Mode;
+typedef enum {
+  PowerDown,
+  Idle,
+  Receive,
+  Transmit,
+
+  ModeNrOf  // Keep last
+} Mode;
+
+typedef enum {
+  TxIdle,     // No transmission
+  TxPowerUp,  // Waking up from PowerDown until txDeadline, then transmit
+  TxSending,  // Waiting for DR of the (next) frame
+  TxPulse,    // TRX_CE low between pulsed frames until txDeadline
+  TxBurst,    // Hardware retransmission running until txDeadline
+  TxStop,     // TRX_CE dropped, radio finishes the last frame until txDeadline
+} TxState;
 
 typedef enum {
   ClkOut4000000 = 0x00,
@@ -48,6 +96,12 @@ typedef enum {
 
 typedef enum { PowerNormal = 0x00, PowerReduced = 0x01 } RxPower;
 
+typedef enum {
+  VerifyNone,     // Trust config writes
+  VerifyChanged,  // Read back the written register range
+  VerifyFull,     // Read back the full register image
+} VerifyPolicy;
+
 typedef struct {
   uint16_t channel;          // nRF905 RF channel
   bool band;                 // nRF905 href_ppl: false=434MHz band, true=868MHZ band
@@ -83,82 +137,328 @@ typedef struct {
   uint8_t payload[NRF905_MAX_FRAMESIZE];
 } Buffer;
 
-typedef std::function<void(void)> TxReadyCalllback;
-typedef std::function<void(const uint8_t *const pBuffer, const uint8_t size)> RxCompleteCallback;
+#ifdef USE_HOST
+/* Host build: wakes the radio thread, like a task notification does on ESP32 */
+class RadioWake {
+ public:
+  void notify(void) {
+    {
+      std::lock_guard<std::mutex> lock(this->_mutex);
+      this->_pending = true;
+    }
+    this->_condition.notify_one();
+  }
+
+  void wait(const uint32_t ms) {
+    std::unique_lock<std::mutex> lock(this->_mutex);
+
+    (void) this->_condition.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return this->_pending; });
+    this->_pending = false;
+  }
+
+ protected:
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _pending{false};
+};
+#endif
+
+/* Edge flags raised by the DR/AM pin interrupts and consumed by loop() or the radio task */
+struct nRF905Store {
+  volatile bool dr_event{true};
+  volatile bool am_event{true};
+#ifdef USE_ESP32
+  TaskHandle_t task{NULL};  // Radio task to wake up, if running
+#endif
+#ifdef USE_HOST
+  RadioWake *wake{NULL};  // Radio thread to wake up, if running
+#endif
+
+  static void gpio_intr_dr(nRF905Store *arg);
+  static void gpio_intr_am(nRF905Store *arg);
+#ifdef NRF905_RADIO_TASK
+  void notify(void);
+#endif
+};
+
+/* Radio task mode: main loop -> radio task */
+typedef enum {
+  CommandSetMode,
+  CommandConfig,
+  CommandTxAddress,
+  CommandTxPayload,
+  CommandStartTx,
+  CommandChannelConfig,
+  CommandResetSpiStats,
+  CommandTraceMark,
+} RadioCommandType;
+
+typedef struct {
+  RadioCommandType type;
+  Mode mode;                              // SetMode: new mode, StartTx: mode after the burst
+  uint32_t value;                         // TxAddress: address, StartTx: frames, TraceMark: tag
+  uint8_t length;                         // TxPayload: payload length
+  uint8_t payload[NRF905_MAX_FRAMESIZE];  // TxPayload: payload
+  Config config;                          // Config: register image, ChannelConfig: channel, band and tx_power
+} RadioCommand;
+
+/* Radio task mode: radio task -> main loop; received frames go through the RX queue */
+typedef enum {
+  EventTxReady,
+} RadioEventType;
+
+typedef struct {
+  RadioEventType type;
+} RadioEvent;
+
+typedef struct {
+  uint32_t time;                          // millis() the frame was read from the radio
+  uint32_t timeUs;                        // micros() of the same moment
+  uint8_t length;                         // Payload length
+  uint8_t payload[NRF905_MAX_FRAMESIZE];  // Payload
+} RxFrame;
+
+typedef struct {
+  uint32_t frames;     // Frames queued
+  uint32_t overflows;  // Frames dropped on a full queue
+  uint32_t invalid;    // Address matched but no valid frame (CRC error)
+} RxStats;
+
+typedef struct {
+  uint32_t transactions;  // Chip select cycles
+  uint32_t bytes;         // Bytes clocked, command byte included
+} SpiStats;
+
+/* SPI trace record, as dumped */
+typedef enum {
+  TraceSpi,   // SPI transaction
+  TraceMode,  // setMode() GPIO writes
+  TraceMark,  // Marker from the protocol layer, e.g. start of a poll cycle
+} TraceKind;
+
+typedef struct __attribute__((packed)) {
+  uint32_t time;    // micros()
+  uint8_t kind;     // TraceKind
+  uint8_t command;  // SPI command byte, new Mode or mark tag
+  uint8_t length;   // SPI bytes clocked, command byte included
+  uint8_t status;   // SPI status byte clocked out, previous Mode for TraceMode
+} TraceRecord;
+
+// Plain function plus context pointer; nothing to allocate when a callback is set or called
+typedef void (*TxReadyCallback)(void *const pArg);
+typedef void (*RxCompleteCallback)(void *const pArg, const uint8_t *const pBuffer, const uint8_t size);
 
 class nRF905 : public Component,
                public spi::SPIDevice<spi::BIT_ORDER_MSB_FIRST, spi::CLOCK_POLARITY_LOW, spi::CLOCK_PHASE_LEADING,
                                      spi::DATA_RATE_1MHZ> {
  public:
   nRF905();
+#ifdef USE_HOST
+  ~nRF905();  // Host build: components are torn down between tests, the radio thread with them
+#endif
 
   void setup() override;
 
-  // float get_setup_priority() const override { return setup_priority::HARDWARE; }
-  float get_setup_priority() const override { return setup_priority::AFTER_CONNECTION; }
+  // Before the protocol components, they configure the radio in their setup()
+  float get_setup_priority() const override { return setup_priority::HARDWARE; }
 
   void dump_config() override;
   void loop() override;
 
-  void set_am_pin(GPIOPin *const pin) { _gpio_pin_am = pin; }
+  void set_am_pin(InternalGPIOPin *const pin) { _gpio_pin_am = pin; }
   void set_cd_pin(GPIOPin *const pin) { _gpio_pin_cd = pin; }
   void set_ce_pin(GPIOPin *const pin) { _gpio_pin_ce = pin; }
-  void set_dr_pin(GPIOPin *const pin) { _gpio_pin_dr = pin; }
+  void set_dr_pin(InternalGPIOPin *const pin) { _gpio_pin_dr = pin; }
   void set_pwr_pin(GPIOPin *const pin) { _gpio_pin_pwr = pin; }
   void set_txen_pin(GPIOPin *const pin) { _gpio_pin_txen = pin; }
 
-  void setOnRxComplete(RxCompleteCallback callback) { onRxComplete = callback; }
-  void setOnTxReady(TxReadyCalllback callback) { onTxReady = callback; }
-
-  Mode getMode(void) { return this->_mode; };
+  void set_verify_policy(const VerifyPolicy policy) { _verifyPolicy = policy; }
+  void set_spi_self_test(const bool enable) { _spiSelfTest = enable; }
+  void set_auto_retransmit(const bool enable) { _autoRetransmit = enable; }
+  void set_mode_time_sensor(const Mode mode, sensor::Sensor *const sensor) { _modeTimeSensor[mode] = sensor; }
+  void set_radio_task(const bool enable) { _radioTask = enable; }
+  void set_spi_trace_size(const uint16_t size) { _traceSize = size; }
+
+  void setOnRxComplete(const RxCompleteCallback callback, void *const pArg) {
+    onRxComplete = callback;
+    onRxCompleteArg = pArg;
+  }
+  void setOnTxReady(const TxReadyCallback callback, void *const pArg) {
+    onTxReady = callback;
+    onTxReadyArg = pArg;
+  }
+
+  // With the radio task running: the mode the queued commands leave the radio in
+  Mode getMode(void) { return (this->deferToTask() == true) ? this->_loopMode : this->_mode; };
   void setMode(const Mode mode);
+  uint32_t getModeTime(const Mode mode);
 
-  Config getConfig(void) { return this->_config; }
+  Config getConfig(void);
   void updateConfig(Config *config, uint8_t *const pStatus = NULL);
+  void setChannelConfig(const uint16_t channel, const bool band, const int8_t txPower, uint8_t *const pStatus = NULL);
 
+  // With the radio task running, setMode(), updateConfig(), setChannelConfig(), writeTxAddress(), writeTxPayload(),
+  // startTx(), resetSpiStats() and traceMark() are queued to the task and return right away; pStatus then holds the
+  // last known status. Other radio access is for setup() only.
   void writeTxAddress(const uint32_t txAddress, uint8_t *const pStatus = NULL);
   void readTxAddress(uint32_t *const pTxAddress, uint8_t *const pStatus = NULL);
 
   void writeTxPayload(const uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus = NULL);
   void readTxPayload(uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus = NULL);
 
+  // Received frames, oldest first; the frame stays valid until releaseRxFrame(). Without an onRxComplete callback
+  // the consumer drains the queue itself, e.g. each loop: while ((pFrame = peekRxFrame()) != NULL) {...}
+  const RxFrame *peekRxFrame(void) { return this->_rxQueue.front(); }
+  void releaseRxFrame(void) { this->_rxQueue.release(); }
+  RxStats getRxStats(void);
+
   bool airwayBusy(void);
+  bool hasCarrierDetect(void) { return this->_gpio_pin_cd != NULL; }
 
-  void startTx(const uint32_t retransmit, const Mode nextMode);
+  uint8_t getStatus(void) { return (this->deferToTask() == true) ? this->_taskStatus.load() : this->_status; }
+
+  const SpiStats &getSpiStats(void) { return this->_spiStats; }
+  void resetSpiStats(void);
+
+  // SPI trace; marks split the trace into cycles for the bus occupancy report of tools/spi_trace.py
+  void traceMark(const uint8_t tag);
+  void dumpSpiTrace(void);
+
+  void startTx(const uint32_t frames, const Mode nextMode);
 
   void printConfig(const Config *const pConfig);
 
  protected:
-  void readRxPayload(uint8_t *const pData, const uint8_t dataLength, uint8_t *const pStatus = NULL);
+  uint8_t readRxPayload(uint8_t *const pData, uint8_t *const pStatus = NULL);
 
   void readConfigRegisters(uint8_t *const pStatus = NULL);
   void writeConfigRegisters(uint8_t *const pStatus = NULL);
+  bool verifyConfigRegisters(const uint8_t offset, const uint8_t length);
+
+  void spiSelfTest(void);
 
   void decodeConfigRegisters(const ConfigBuffer *const pBuffer, Config *const pConfig);
   void encodeConfigRegisters(const Config *const pConfig, ConfigBuffer *const pBuffer);
+  uint8_t encodeTxPower(const int8_t txPower);
 
   uint8_t readStatus(void);
+  uint8_t readPinStatus(void);
+  uint8_t pollStatus(void);
+  bool statusPollDue(void);
 
   void spiTransfer(uint8_t *const data, const size_t length);
+  uint8_t spiRead(const uint8_t command, uint8_t *const data, const size_t length);
+  void spiComplete(const uint8_t command, const uint8_t status, const size_t length);
+  void traceRecord(const TraceKind kind, const uint8_t command, const uint8_t length, const uint8_t status);
+
+  void restoreMode(const Mode mode);
+  void setCe(const bool level);
+
+  void service(void);
+  void receiveFrame(void);
+  void dispatchRxFrames(void);
+  void txFrameDone(void);
+  void txComplete(void);
+  void accountModeTime(void);
+
+  bool taskRunning(void);
+  bool deferToTask(void);
+  void startTask(void);
+  bool pushCommand(const RadioCommand &command);
+  void runCommand(const RadioCommand &command);
+  void runTask(void);
+  void publishTaskState(void);
+  void dispatchEvents(void);
+#ifdef USE_ESP32
+  static void radioTask(void *arg);
+#endif
+  uint32_t frameAirTime(void);
+
+  uint8_t rxPayloadWidth(void);
+  uint8_t txPayloadWidth(void);
 
   char *hexArrayToStr(const uint8_t *const pData, const size_t dataLength);
 
   RxCompleteCallback onRxComplete{NULL};
-
-  uint32_t retransmitCounter{0};
+  void *onRxCompleteArg{NULL};
+  SpscQueue<RxFrame, RX_QUEUE_SIZE> _rxQueue;  // Filled by service(), drained by the consumer
+  uint8_t _rxPayload[NRF905_MAX_FRAMESIZE];    // Payload of a frame that didn't fit in the queue
+  RxStats _rxStats{0, 0, 0};
+
+  uint32_t retransmitCounter{0};  // Frames still to go in the current burst
+  TxState txState{TxIdle};
+  uint32_t txDeadline{0};  // micros()
+  uint32_t txStartTime{0};  // millis() of startTx(), for MAX_TRANSMIT_TIME
   Mode nextMode{PowerDown};
-  TxReadyCalllback onTxReady{NULL};
+  TxReadyCallback onTxReady{NULL};
+  void *onTxReadyArg{NULL};
 
-  GPIOPin *_gpio_pin_am{NULL};
+  InternalGPIOPin *_gpio_pin_am{NULL};
   GPIOPin *_gpio_pin_cd{NULL};
   GPIOPin *_gpio_pin_ce{NULL};
-  GPIOPin *_gpio_pin_dr{NULL};
+  InternalGPIOPin *_gpio_pin_dr{NULL};
   GPIOPin *_gpio_pin_pwr{NULL};
   GPIOPin *_gpio_pin_txen{NULL};
 
+  HighFrequencyLoopRequester _highFrequency;  // Held while a transmission runs from loop()
+  uint32_t _txTimeouts{0};                     // Transmissions ended by MAX_TRANSMIT_TIME
+
   Mode _mode{PowerDown};
+  uint64_t _modeTime[ModeNrOf]{};             // Time spent in each mode (in us)
+  uint32_t _modeTimeStart{0};                 // micros() the current mode was last accounted
+  sensor::Sensor *_modeTimeSensor[ModeNrOf]{};
+
+  nRF905Store _store;
+
+  uint8_t _lastState{0x00};     // DR/AM as service() last acted on them
+  bool _addrMatch{false};       // AM seen without DR; AM dropping alone means a CRC error
+
+  uint8_t _status{0};           // Last status byte clocked out by any SPI command
+  bool _statusValid{false};     // A status was captured
+  Mode _statusMode{PowerDown};  // Mode the status was captured in; only reused in that mode
+  uint32_t _statusTime{0};      // micros() of the last status capture
+  uint32_t _pollTime{0};        // millis() of the last status poll while Idle/PowerDown
+  uint32_t _pollInterval{0};    // Current status poll interval while Idle/PowerDown
 
   Config _config;
+
+  uint8_t _registers[NRF905_REGISTER_COUNT];  // Shadow of the radio config registers
+  bool _registersValid{false};                 // Shadow matches the radio
+  uint32_t _txAddress{0};                      // Shadow of the TX address register
+  bool _txAddressValid{false};                 // TX address shadow matches the radio
+  VerifyPolicy _verifyPolicy{VerifyChanged};
+
+  SpiStats _spiStats{0, 0};
+
+  // SPI trace ring buffer; allocated once at setup, recording is a few stores per transaction
+  TraceRecord *_trace{NULL};
+  uint16_t _traceSize{0};    // Records, 0 disables the trace
+  uint16_t _traceCount{0};   // Records in use
+  uint16_t _traceNext{0};    // Next record to write
+  bool _tracePaused{false};  // Set while dumping
+
+  bool _autoRetransmit{true};  // Use AUTO_RETRAN for bursts, else pulse TRX_CE per frame
+
+  // Radio task mode; the task runs service() and the SPI traffic, the main loop only exchanges queue entries
+  bool _radioTask{false};
+#ifdef USE_ESP32
+  TaskHandle_t _task{NULL};
+#endif
+#ifdef USE_HOST
+  std::thread _thread;
+  std::atomic<bool> _threadStop{false};
+  RadioWake _wake;
+#endif
+  Config _loopConfig;  // Config as the main loop last set it; getConfig() returns it while the task owns _config
+  Mode _loopMode{PowerDown};  // Mode the main loop last asked for, directly or as the end of a burst
+  std::atomic<uint8_t> _taskStatus{0};              // _status as of the last task run
+  std::atomic<uint32_t> _taskModeTime[ModeNrOf]{};  // _modeTime as of the last task run (in ms)
+  SpscQueue<RadioCommand, RADIO_QUEUE_SIZE> _commandQueue;
+  SpscQueue<RadioEvent, RADIO_QUEUE_SIZE> _eventQueue;
+
+  bool _spiSelfTest{false};
+  uint32_t _selfTestRate{0};    // Achieved transfers per second
+  uint32_t _selfTestErrors{0};  // Read-back mismatches
 };
 
 }  // namespace nrf905
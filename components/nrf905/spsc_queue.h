@@ -0,0 +1,84 @@
+#ifndef __COMPONENT_nRF905_SPSC_QUEUE_H__
+#define __COMPONENT_nRF905_SPSC_QUEUE_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace esphome {
+namespace nrf905 {
+
+/* Lock-free single producer, single consumer ring buffer
+ *
+ * One task only produces (push() or acquire()/commit()), one other task only consumes (pop() or front()/release()).
+ * acquire() and front() hand out the slot itself, so large items are filled and read in place. Size must be a power
+ * of two; one slot stays empty to tell full from empty.
+ */
+template<typename T, uint8_t Size> class SpscQueue {
+  static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+ public:
+  bool push(const T &item) {
+    T *const pSlot = this->acquire();
+
+    if (pSlot == NULL) {
+      return false;
+    }
+    *pSlot = item;
+    this->commit();
+    return true;
+  }
+
+  bool pop(T *const pItem) {
+    const T *const pSlot = this->front();
+
+    if (pSlot == NULL) {
+      return false;
+    }
+    *pItem = *pSlot;
+    this->release();
+    return true;
+  }
+
+  // Producer: free slot to fill, NULL when full. The item becomes visible on commit().
+  T *acquire(void) {
+    const uint8_t head = this->head_.load(std::memory_order_relaxed);
+
+    if (((head + 1) & (Size - 1)) == this->tail_.load(std::memory_order_acquire)) {
+      ++this->overflows_;
+      return NULL;  // Full
+    }
+    return &this->items_[head];
+  }
+
+  void commit(void) {
+    this->head_.store((this->head_.load(std::memory_order_relaxed) + 1) & (Size - 1), std::memory_order_release);
+  }
+
+  // Consumer: oldest item, NULL when empty. The slot is handed back on release().
+  T *front(void) {
+    const uint8_t tail = this->tail_.load(std::memory_order_relaxed);
+
+    if (tail == this->head_.load(std::memory_order_acquire)) {
+      return NULL;  // Empty
+    }
+    return &this->items_[tail];
+  }
+
+  void release(void) {
+    this->tail_.store((this->tail_.load(std::memory_order_relaxed) + 1) & (Size - 1), std::memory_order_release);
+  }
+
+  uint32_t getOverflows(void) const { return this->overflows_; }
+
+ protected:
+  T items_[Size];
+  std::atomic<uint8_t> head_{0};  // Next slot to write, owned by the producer
+  std::atomic<uint8_t> tail_{0};  // Next slot to read, owned by the consumer
+  uint32_t overflows_{0};         // Pushes dropped on a full queue, producer side
+};
+
+}  // namespace nrf905
+}  // namespace esphome
+
+#endif /* __COMPONENT_nRF905_SPSC_QUEUE_H__ */
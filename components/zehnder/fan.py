@@ -1,25 +1,79 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import fan
-from esphome.const import CONF_ID, CONF_UPDATE_INTERVAL
+from esphome.components import fan, sensor
+from esphome.const import (
+    CONF_ID,
+    CONF_UPDATE_INTERVAL,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+)
 
-from esphome.components.nrf905 import nRF905Component
+from esphome.components.nrf905 import MODES, nRF905Component
 
 
 DEPENDENCIES = ["nrf905"]
+AUTO_LOAD = ["sensor"]
 
 zehnder_ns = cg.esphome_ns.namespace("zehnder")
 ZehnderRF = zehnder_ns.class_("ZehnderRF", fan.FanState)
+Metric = zehnder_ns.enum("Metric")
 
 CONF_NRF905 = "nrf905"
+CONF_MAX_UPDATE_INTERVAL = "max_update_interval"
+CONF_COMMAND_TIMEOUT = "command_timeout"
+CONF_RADIO_IDLE_MODE = "radio_idle_mode"
+CONF_CAPTURE_SIZE = "capture_size"
+
+COUNTER_SCHEMA = sensor.sensor_schema(
+    icon="mdi:counter",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+LATENCY_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    icon="mdi:timer-outline",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+# Link metrics, published every minute
+METRIC_SENSORS = {
+    "tx_frames": (Metric.MetricTxFrames, COUNTER_SCHEMA),
+    "rx_frames": (Metric.MetricRxFrames, COUNTER_SCHEMA),
+    "duplicate_frames": (Metric.MetricDuplicates, COUNTER_SCHEMA),
+    "retries": (Metric.MetricRetries, COUNTER_SCHEMA),
+    "timeouts": (Metric.MetricTimeouts, COUNTER_SCHEMA),
+    "airway_timeouts": (Metric.MetricAirwayTimeouts, COUNTER_SCHEMA),
+    "failed_commands": (Metric.MetricFailedCommands, COUNTER_SCHEMA),
+    "round_trip_time": (Metric.MetricRtt, LATENCY_SCHEMA),
+    "airway_wait_time": (Metric.MetricAirwayWait, LATENCY_SCHEMA),
+    "control_latency": (Metric.MetricControlLatency, LATENCY_SCHEMA),
+}
 
 CONFIG_SCHEMA = fan.FAN_SCHEMA.extend(
     {
         cv.GenerateID(): cv.declare_id(ZehnderRF),
         cv.Required(CONF_NRF905): cv.use_id(nRF905Component),
         cv.Optional(CONF_UPDATE_INTERVAL, default="30s"): cv.update_interval,
+        cv.Optional(
+            CONF_MAX_UPDATE_INTERVAL, default="10min"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(
+            CONF_COMMAND_TIMEOUT, default="30s"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_RADIO_IDLE_MODE, default="RECEIVE"): cv.enum(
+            MODES, upper=True, space="_"
+        ),
+        # Frames kept for dump_capture() and the web_server /capture download, 24 bytes each; 0 disables the capture
+        cv.Optional(CONF_CAPTURE_SIZE, default=0): cv.int_range(min=0, max=4096),
     }
-).extend(cv.COMPONENT_SCHEMA)
+).extend({cv.Optional(key): schema for key, (_, schema) in METRIC_SENSORS.items()}).extend(
+    cv.COMPONENT_SCHEMA
+)
 
 
 async def to_code(config):
@@ -31,3 +85,12 @@ async def to_code(config):
     cg.add(var.set_rf(nrf905))
 
     cg.add(var.set_update_interval(config[CONF_UPDATE_INTERVAL]))
+    cg.add(var.set_max_update_interval(config[CONF_MAX_UPDATE_INTERVAL]))
+    cg.add(var.set_command_timeout(config[CONF_COMMAND_TIMEOUT]))
+    cg.add(var.set_idle_mode(config[CONF_RADIO_IDLE_MODE]))
+    cg.add(var.set_capture_size(config[CONF_CAPTURE_SIZE]))
+
+    for key, (metric, _) in METRIC_SENSORS.items():
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(var.set_metric_sensor(metric, sens))
@@ -0,0 +1,86 @@
+#ifndef __COMPONENT_ZEHNDER_HISTOGRAM_H__
+#define __COMPONENT_ZEHNDER_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <string.h>
+
+namespace esphome {
+namespace zehnder {
+
+#define HISTOGRAM_BUCKETS 12
+
+// Bucket upper bounds in ms; the last bucket holds everything above
+static const uint32_t HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS - 1] = {10,   20,   50,   100,   200,  500,
+                                                                 1000, 2000, 5000, 10000, 30000};
+
+/* Fixed-bucket latency histogram; values in ms, percentiles resolve to a bucket upper bound */
+class LatencyHistogram {
+ public:
+  void add(const uint32_t value) {
+    uint8_t i = 0;
+
+    while ((i < (HISTOGRAM_BUCKETS - 1)) && (value > HISTOGRAM_BOUNDS[i])) {
+      ++i;
+    }
+    ++this->buckets_[i];
+
+    if ((this->count_ == 0) || (value < this->min_)) {
+      this->min_ = value;
+    }
+    if (value > this->max_) {
+      this->max_ = value;
+    }
+    ++this->count_;
+    this->sum_ += value;
+  }
+
+  void reset(void) {
+    (void) memset(this->buckets_, 0, sizeof(this->buckets_));
+    this->count_ = 0;
+    this->sum_ = 0;
+    this->min_ = 0;
+    this->max_ = 0;
+  }
+
+  uint32_t getCount(void) const { return this->count_; }
+  uint32_t getMin(void) const { return this->min_; }
+  uint32_t getMax(void) const { return this->max_; }
+  uint32_t getAverage(void) const { return (this->count_ > 0) ? (uint32_t) (this->sum_ / this->count_) : 0; }
+
+  uint32_t getPercentile(const uint8_t percentile) const {
+    uint32_t target;
+    uint32_t total = 0;
+
+    if (this->count_ == 0) {
+      return 0;
+    }
+
+    target = ((this->count_ * percentile) + 99) / 100;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+      total += this->buckets_[i];
+      if (total >= target) {
+        // Last bucket is open ended, and no bound is worse than the worst sample
+        if ((i == (HISTOGRAM_BUCKETS - 1)) || (HISTOGRAM_BOUNDS[i] > this->max_)) {
+          return this->max_;
+        }
+        return HISTOGRAM_BOUNDS[i];
+      }
+    }
+
+    return this->max_;
+  }
+
+  uint32_t getBucket(const uint8_t index) const { return this->buckets_[index]; }
+
+ protected:
+  uint32_t buckets_[HISTOGRAM_BUCKETS]{};
+  uint32_t count_{0};
+  uint64_t sum_{0};
+  uint32_t min_{0};
+  uint32_t max_{0};
+};
+
+}  // namespace zehnder
+}  // namespace esphome
+
+#endif /* __COMPONENT_ZEHNDER_HISTOGRAM_H__ */
@@ -0,0 +1,196 @@
+#ifndef __COMPONENT_ZEHNDER_RF_FRAME_H__
+#define __COMPONENT_ZEHNDER_RF_FRAME_H__
+
+#include <stdint.h>
+#include <string.h>
+
+namespace esphome {
+namespace zehnder {
+
+#define FAN_FRAMESIZE 16      // Each frame consists of 16 bytes
+#define FAN_PARAMETERS_MAX 9  // Parameter bytes after the 7 byte header
+#define FAN_TTL 250           // 0xFA, default time-to-live for a frame
+
+/* Fan device types */
+enum {
+  FAN_TYPE_BROADCAST = 0x00,       // Broadcast to all devices
+  FAN_TYPE_MAIN_UNIT = 0x01,       // Fans
+  FAN_TYPE_REMOTE_CONTROL = 0x03,  // Remote controls
+  FAN_TYPE_CO2_SENSOR = 0x18
+};  // CO2 sensors
+
+/* Fan commands */
+enum {
+  FAN_FRAME_SETVOLTAGE = 0x01,  // Set speed (voltage / percentage)
+  FAN_FRAME_SETSPEED = 0x02,    // Set speed (preset)
+  FAN_FRAME_SETTIMER = 0x03,    // Set speed with timer
+  FAN_NETWORK_JOIN_REQUEST = 0x04,
+  FAN_FRAME_SETSPEED_REPLY = 0x05,
+  FAN_NETWORK_JOIN_OPEN = 0x06,
+  FAN_TYPE_FAN_SETTINGS = 0x07,  // Current settings, sent by fan in reply to 0x01, 0x02, 0x10
+  FAN_FRAME_0B = 0x0B,
+  FAN_NETWORK_JOIN_ACK = 0x0C,
+  // FAN_NETWORK_JOIN_FINISH = 0x0D,
+  FAN_TYPE_QUERY_NETWORK = 0x0D,
+  FAN_TYPE_QUERY_DEVICE = 0x10,
+  FAN_FRAME_SETVOLTAGE_REPLY = 0x1D
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t networkId;
+} RfPayloadNetworkJoinOpen;
+
+typedef struct __attribute__((packed)) {
+  uint32_t networkId;
+} RfPayloadNetworkJoinRequest;
+
+typedef struct __attribute__((packed)) {
+  uint32_t networkId;
+} RfPayloadNetworkJoinAck;
+
+typedef struct __attribute__((packed)) {
+  uint8_t speed;
+  uint8_t voltage;
+  uint8_t timer;
+} RfPayloadFanSettings;
+
+typedef struct __attribute__((packed)) {
+  uint8_t speed;
+} RfPayloadFanSetSpeed;
+
+typedef struct __attribute__((packed)) {
+  uint8_t speed;
+  uint8_t timer;
+} RfPayloadFanSetTimer;
+
+typedef struct __attribute__((packed)) {
+  uint8_t rx_type;          // 0x00 RX Type
+  uint8_t rx_id;            // 0x01 RX ID
+  uint8_t tx_type;          // 0x02 TX Type
+  uint8_t tx_id;            // 0x03 TX ID
+  uint8_t ttl;              // 0x04 Time-To-Live
+  uint8_t command;          // 0x05 Frame type
+  uint8_t parameter_count;  // 0x06 Number of parameters
+
+  union {
+    uint8_t parameters[FAN_PARAMETERS_MAX];          // 0x07 - 0x0F Depends on command
+    RfPayloadFanSetSpeed setSpeed;                   // Command 0x02
+    RfPayloadFanSetTimer setTimer;                   // Command 0x03
+    RfPayloadNetworkJoinRequest networkJoinRequest;  // Command 0x04
+    RfPayloadNetworkJoinOpen networkJoinOpen;        // Command 0x06
+    RfPayloadFanSettings fanSettings;                // Command 0x07
+    RfPayloadNetworkJoinAck networkJoinAck;          // Command 0x0C
+  } payload;
+} RfFrame;
+
+static_assert(sizeof(RfFrame) == FAN_FRAMESIZE, "RfFrame must match the on-air frame size");
+
+/* Source and destination of a frame */
+typedef struct {
+  uint8_t rx_type;
+  uint8_t rx_id;
+  uint8_t tx_type;
+  uint8_t tx_id;
+} RfRoute;
+
+/* Builders; each fills a FAN_FRAMESIZE buffer in place, unused parameter bytes cleared */
+
+inline RfFrame *rfFrameInit(uint8_t *const pBuffer, const RfRoute &route, const uint8_t command,
+                            const uint8_t parameterCount) {
+  RfFrame *const pFrame = (RfFrame *) pBuffer;
+
+  (void) memset(pBuffer, 0, FAN_FRAMESIZE);
+  pFrame->rx_type = route.rx_type;
+  pFrame->rx_id = route.rx_id;
+  pFrame->tx_type = route.tx_type;
+  pFrame->tx_id = route.tx_id;
+  pFrame->ttl = FAN_TTL;
+  pFrame->command = command;
+  pFrame->parameter_count = parameterCount;
+
+  return pFrame;
+}
+
+inline void rfBuildQueryDevice(uint8_t *const pBuffer, const RfRoute &route) {
+  rfFrameInit(pBuffer, route, FAN_TYPE_QUERY_DEVICE, 0);
+}
+
+inline void rfBuildSetSpeed(uint8_t *const pBuffer, const RfRoute &route, const uint8_t speed) {
+  rfFrameInit(pBuffer, route, FAN_FRAME_SETSPEED, sizeof(RfPayloadFanSetSpeed))->payload.setSpeed.speed = speed;
+}
+
+inline void rfBuildSetTimer(uint8_t *const pBuffer, const RfRoute &route, const uint8_t speed, const uint8_t timer) {
+  RfFrame *const pFrame = rfFrameInit(pBuffer, route, FAN_FRAME_SETTIMER, sizeof(RfPayloadFanSetTimer));
+
+  pFrame->payload.setTimer.speed = speed;
+  pFrame->payload.setTimer.timer = timer;
+}
+
+inline void rfBuildJoinRequest(uint8_t *const pBuffer, const RfRoute &route, const uint32_t networkId) {
+  rfFrameInit(pBuffer, route, FAN_NETWORK_JOIN_REQUEST, sizeof(RfPayloadNetworkJoinRequest))
+      ->payload.networkJoinRequest.networkId = networkId;
+}
+
+// Announce being available for linking on networkId
+inline void rfBuildJoinAck(uint8_t *const pBuffer, const RfRoute &route, const uint32_t networkId) {
+  rfFrameInit(pBuffer, route, FAN_NETWORK_JOIN_ACK, sizeof(RfPayloadNetworkJoinAck))
+      ->payload.networkJoinAck.networkId = networkId;
+}
+
+// 0x0B, acknowledge link successful
+inline void rfBuildLinkAck(uint8_t *const pBuffer, const RfRoute &route) {
+  rfFrameInit(pBuffer, route, FAN_FRAME_0B, 0);
+}
+
+inline void rfBuildSetSpeedReply(uint8_t *const pBuffer, const RfRoute &route) {
+  RfFrame *const pFrame = rfFrameInit(pBuffer, route, FAN_FRAME_SETSPEED_REPLY, 3);
+
+  pFrame->payload.parameters[0] = 0x54;
+  pFrame->payload.parameters[1] = 0x03;
+  pFrame->payload.parameters[2] = 0x20;
+}
+
+/* Decoder */
+
+// Parameter bytes a command needs before its payload fields can be read
+inline uint8_t rfMinParameters(const uint8_t command) {
+  switch (command) {
+    case FAN_FRAME_SETSPEED:
+    case FAN_FRAME_SETVOLTAGE:
+      return sizeof(RfPayloadFanSetSpeed);
+
+    case FAN_FRAME_SETTIMER:
+      return sizeof(RfPayloadFanSetTimer);
+
+    case FAN_TYPE_FAN_SETTINGS:
+      return sizeof(RfPayloadFanSettings);
+
+    case FAN_NETWORK_JOIN_REQUEST:
+    case FAN_NETWORK_JOIN_OPEN:
+    case FAN_NETWORK_JOIN_ACK:
+      return sizeof(RfPayloadNetworkJoinOpen);
+
+    default:
+      return 0;
+  }
+}
+
+// Typed view of a received buffer, without copying; NULL when the frame is malformed
+inline const RfFrame *rfFrameDecode(const uint8_t *const pData, const uint8_t dataLength) {
+  const RfFrame *const pFrame = (const RfFrame *) pData;
+
+  if ((pData == NULL) || (dataLength < FAN_FRAMESIZE)) {
+    return NULL;
+  }
+  if ((pFrame->parameter_count > FAN_PARAMETERS_MAX) ||
+      (pFrame->parameter_count < rfMinParameters(pFrame->command))) {
+    return NULL;
+  }
+
+  return pFrame;
+}
+
+}  // namespace zehnder
+}  // namespace esphome
+
+#endif /* __COMPONENT_ZEHNDER_RF_FRAME_H__ */
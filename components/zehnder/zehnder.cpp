@@ -1,62 +1,14 @@
 #include "zehnder.h"
 #include "esphome/core/log.h"
 #include "esphome/core/application.h"
+#include "esphome/components/nrf905/hex_dump.h"
 
 namespace esphome {
 namespace zehnder {
 
-#define MAX_TRANSMIT_TIME 2000
-
 static const char *const TAG = "zehnder";
 
-typedef struct __attribute__((packed)) {
-  uint32_t networkId;
-} RfPayloadNetworkJoinOpen;
-
-typedef struct __attribute__((packed)) {
-  uint32_t networkId;
-} RfPayloadNetworkJoinRequest;
-
-typedef struct __attribute__((packed)) {
-  uint32_t networkId;
-} RfPayloadNetworkJoinAck;
-
-typedef struct __attribute__((packed)) {
-  uint8_t speed;
-  uint8_t voltage;
-  uint8_t timer;
-} RfPayloadFanSettings;
-
-typedef struct __attribute__((packed)) {
-  uint8_t speed;
-} RfPayloadFanSetSpeed;
-
-typedef struct __attribute__((packed)) {
-  uint8_t speed;
-  uint8_t timer;
-} RfPayloadFanSetTimer;
-
-typedef struct __attribute__((packed)) {
-  uint8_t rx_type;          // 0x00 RX Type
-  uint8_t rx_id;            // 0x01 RX ID
-  uint8_t tx_type;          // 0x02 TX Type
-  uint8_t tx_id;            // 0x03 TX ID
-  uint8_t ttl;              // 0x04 Time-To-Live
-  uint8_t command;          // 0x05 Frame type
-  uint8_t parameter_count;  // 0x06 Number of parameters
-
-  union {
-    uint8_t parameters[9];                           // 0x07 - 0x0F Depends on command
-    RfPayloadFanSetSpeed setSpeed;                   // Command 0x02
-    RfPayloadFanSetTimer setTimer;                   // Command 0x03
-    RfPayloadNetworkJoinRequest networkJoinRequest;  // Command 0x04
-    RfPayloadNetworkJoinOpen networkJoinOpen;        // Command 0x06
-    RfPayloadFanSettings fanSettings;                // Command 0x07
-    RfPayloadNetworkJoinAck networkJoinAck;          // Command 0x0C
-  } payload;
-} RfFrame;
-
-ZehnderRF::ZehnderRF(void) : errorCode_(NO_ERROR) {} 
+ZehnderRF::ZehnderRF(void) {}
 
 fan::FanTraits ZehnderRF::get_traits() { return fan::FanTraits(false, true, false, this->speed_count_); }
 
@@ -70,17 +22,8 @@ void ZehnderRF::control(const fan::FanCall &call) {
     ESP_LOGD(TAG, "Control has speed: %u", this->speed);
   }
 
-  switch (this->state_) {
-    case StateIdle:
-      // Set speed
-      this->setSpeed(this->state ? this->speed : 0x00, 0);
-
-      this->lastFanQuery_ = millis();  // Update time
-      break;
-
-    default:
-      break;
-  }
+  // Deliver whatever the state machine is doing; reverts the published state if it can't be confirmed in time
+  this->requestSpeed(this->state ? this->speed : 0x00, 0, true);
 
   this->publish_state();
 }
@@ -97,6 +40,31 @@ void ZehnderRF::setup() {
     ESP_LOGD(TAG, "Config load ok");
   }
 
+  this->speed_count_ = 4;
+
+  // Show the last confirmed settings until the first poll verifies them
+  this->statePref_ = global_preferences->make_preference<SavedState>(fnv1_hash("zehnderrf_state"), true);
+  if ((this->configValid() == true) && (this->statePref_.load(&this->savedState_) == true)) {
+    ESP_LOGD(TAG, "Restored speed 0x%02X voltage %u (stale)", this->savedState_.speed, this->savedState_.voltage);
+
+    this->confirmed_ = true;
+    this->confirmedSpeed_ = this->savedState_.speed;
+    this->confirmedVoltage_ = this->savedState_.voltage;
+    this->stateStale_ = true;
+
+    this->state = this->savedState_.speed > 0;
+    this->speed = this->savedState_.speed;
+    this->voltage = this->savedState_.voltage;
+    this->timer = false;
+    this->publish_state();
+  }
+
+  // Polls relax from update_interval up to max_update_interval
+  if (this->maxInterval_ < this->interval_) {
+    this->maxInterval_ = this->interval_;
+  }
+  this->pollInterval_ = this->interval_;
+
   // Set nRF905 config
   nrf905::Config rfConfig;
   rfConfig = this->rf_->getConfig();
@@ -114,7 +82,8 @@ void ZehnderRF::setup() {
   // // RX power normal
   rfConfig.rx_power = nrf905::PowerNormal;
 
-  rfConfig.rx_address = 0x89816EA9;  // ZEHNDER_NETWORK_LINK_ID;
+  // Paired: listen on the fan network right away, else on the link ID discovery uses
+  rfConfig.rx_address = this->configValid() ? this->config_.fan_networkId : NETWORK_LINK_ID;
   rfConfig.rx_address_width = 4;
   rfConfig.rx_payload_width = 16;
 
@@ -125,69 +94,294 @@ void ZehnderRF::setup() {
   rfConfig.clkOutFrequency = nrf905::ClkOut500000;
   rfConfig.clkOutEnable = false;
 
-  // Write config back
+  // Write config back; only the registers that differ from what the radio holds go over the bus
   this->rf_->updateConfig(&rfConfig);
-  this->rf_->writeTxAddress(0x89816EA9);
+  this->rf_->writeTxAddress(rfConfig.rx_address);
 
-  this->speed_count_ = 4;
+  this->rf_->setOnTxReady([](void *const pArg) { ((ZehnderRF *) pArg)->rfTxReady(); }, this);
 
-  this->rf_->setOnTxReady([this](void) {
-    ESP_LOGD(TAG, "Tx Ready");
-    if (this->rfState_ == RfStateTxBusy) {
-      if (this->retries_ >= 0) {
-        this->msgSendTime_ = millis();
-        this->rfState_ = RfStateRxWait;
-      } else {
-        this->rfState_ = RfStateIdle;
-      }
+  if (this->captureSize_ > 0) {
+    this->capture_ = new CaptureRecord[this->captureSize_];
+#ifdef USE_WEBSERVER
+    if (web_server_base::global_web_server_base != NULL) {
+      web_server_base::global_web_server_base->add_handler(new CaptureHandler(this));
     }
-  });
+#endif
+  }
 
-  this->rf_->setOnRxComplete([this](const uint8_t *const pData, const uint8_t dataLength) {
-    ESP_LOGV(TAG, "Received frame");
-    this->rfHandleReceived(pData, dataLength);
-  });
+  for (uint8_t i = 0; i < MetricNrOf; ++i) {
+    if (this->metricSensor_[i] != NULL) {
+      this->set_interval("metrics", FAN_METRICS_INTERVAL, [this]() { this->publishMetrics(); });
+      break;
+    }
+  }
 }
 
 void ZehnderRF::dump_config(void) {
   ESP_LOGCONFIG(TAG, "Zehnder Fan config:");
   ESP_LOGCONFIG(TAG, "  Polling interval   %u", this->interval_);
+  ESP_LOGCONFIG(TAG, "  Max poll interval  %u", this->maxInterval_);
+  ESP_LOGCONFIG(TAG, "  Radio idle mode    %s",
+                this->idleMode_ == nrf905::Receive ? "receive"
+                                                   : (this->idleMode_ == nrf905::Idle ? "idle" : "power down"));
+  ESP_LOGCONFIG(TAG, "  Next poll after    %u", this->pollDelay());
   ESP_LOGCONFIG(TAG, "  Fan networkId      0x%08X", this->config_.fan_networkId);
   ESP_LOGCONFIG(TAG, "  Fan my device type 0x%02X", this->config_.fan_my_device_type);
   ESP_LOGCONFIG(TAG, "  Fan my device id   0x%02X", this->config_.fan_my_device_id);
   ESP_LOGCONFIG(TAG, "  Fan main_unit type 0x%02X", this->config_.fan_main_unit_type);
   ESP_LOGCONFIG(TAG, "  Fan main unit id   0x%02X", this->config_.fan_main_unit_id);
+  this->dumpLatency("Pairing", this->pairingLatency_);
+  this->dumpLatency("Set speed", this->setSpeedLatency_);
+  this->dumpLatency("Poll", this->pollLatency_);
+  this->dumpLatency("Time to air", this->airwayLatency_);
+  ESP_LOGCONFIG(TAG, "  Duplicate frames   %u", this->duplicateFrames_);
+  ESP_LOGCONFIG(TAG, "  Overheard frames   %u", this->overheardFrames_);
+  ESP_LOGCONFIG(TAG, "  Malformed frames   %u", this->malformedFrames_);
+  ESP_LOGCONFIG(TAG, "  Frame capture      %u/%u", this->captureCount_, this->captureSize_);
+  this->dumpLatency("Round trip", this->rttLatency_);
+  this->dumpCounters("TX frames", this->txFrames_, FAN_COMMAND_SLOTS);
+  this->dumpCounters("RX frames", this->rxFrames_, FAN_COMMAND_SLOTS);
+  this->dumpCounters("Retries used", this->retryCounts_, FAN_TX_RETRIES + 2);
+  this->dumpCounters("Timeouts in state", this->timeouts_, StateNrOf);
+  ESP_LOGCONFIG(TAG, "  Airway timeouts    %u", this->airwayTimeouts_);
+  ESP_LOGCONFIG(TAG, "  Failed commands    %u", this->failedCommands_);
+  for (uint8_t i = 0; i < RttNrOf; ++i) {
+    static const char *const names[RttNrOf] = {"Query RTT", "Set speed RTT", "Join RTT"};
+
+    if (this->rtt_[i].valid == true) {
+      ESP_LOGCONFIG(TAG, "  %-18s srtt=%u rttvar=%u ms", names[i], this->rtt_[i].srtt, this->rtt_[i].rttvar);
+    }
+  }
+}
+
+void ZehnderRF::dumpLatency(const char *const name, const LatencyHistogram &histogram) {
+  ESP_LOGCONFIG(TAG, "  %-18s n=%u p50=%u p90=%u p99=%u max=%u ms", name, histogram.getCount(),
+                histogram.getPercentile(50), histogram.getPercentile(90), histogram.getPercentile(99),
+                histogram.getMax());
+}
+
+// Non-zero counters only, as index:count
+void ZehnderRF::dumpCounters(const char *const name, const uint32_t *const pCounters, const uint8_t count) {
+  char buffer[128];
+  size_t length = 0;
+
+  buffer[0] = '\0';
+  for (uint8_t i = 0; (i < count) && (length < (sizeof(buffer) - 16)); ++i) {
+    if (pCounters[i] > 0) {
+      length += snprintf(&buffer[length], sizeof(buffer) - length, " 0x%02X:%u", i, pCounters[i]);
+    }
+  }
+  ESP_LOGCONFIG(TAG, "  %-18s%s", name, length > 0 ? buffer : " -");
+}
+
+void ZehnderRF::countFrame(uint32_t *const pCounters, const uint8_t command) {
+  ++pCounters[(command < FAN_COMMAND_SLOTS) ? command : 0];
+}
+
+uint32_t ZehnderRF::sumCounters(const uint32_t *const pCounters, const uint8_t count) {
+  uint32_t sum = 0;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    sum += pCounters[i];
+  }
+
+  return sum;
+}
+
+void ZehnderRF::publishMetrics(void) {
+  uint32_t values[MetricNrOf];
+  uint32_t retries = 0;
+
+  for (uint8_t i = 1; i <= FAN_TX_RETRIES; ++i) {
+    retries += i * this->retryCounts_[i];
+  }
+  retries += FAN_TX_RETRIES * this->retryCounts_[FAN_TX_RETRIES + 1];
+
+  values[MetricTxFrames] = this->sumCounters(this->txFrames_, FAN_COMMAND_SLOTS);
+  values[MetricRxFrames] = this->sumCounters(this->rxFrames_, FAN_COMMAND_SLOTS);
+  values[MetricDuplicates] = this->duplicateFrames_;
+  values[MetricRetries] = retries;
+  values[MetricTimeouts] = this->sumCounters(this->timeouts_, StateNrOf);
+  values[MetricAirwayTimeouts] = this->airwayTimeouts_;
+  values[MetricFailedCommands] = this->failedCommands_;
+  values[MetricRtt] = this->rttLatency_.getPercentile(50);
+  values[MetricAirwayWait] = this->airwayLatency_.getPercentile(90);
+  values[MetricControlLatency] = this->setSpeedLatency_.getPercentile(90);
+
+  for (uint8_t i = 0; i < MetricNrOf; ++i) {
+    if (this->metricSensor_[i] != NULL) {
+      this->metricSensor_[i]->publish_state(values[i]);
+    }
+  }
+}
+
+void ZehnderRF::reset_metrics(void) {
+  ESP_LOGD(TAG, "Reset metrics");
+
+  (void) memset(this->txFrames_, 0, sizeof(this->txFrames_));
+  (void) memset(this->rxFrames_, 0, sizeof(this->rxFrames_));
+  (void) memset(this->retryCounts_, 0, sizeof(this->retryCounts_));
+  (void) memset(this->timeouts_, 0, sizeof(this->timeouts_));
+  this->airwayTimeouts_ = 0;
+  this->failedCommands_ = 0;
+  this->duplicateFrames_ = 0;
+  this->overheardFrames_ = 0;
+  this->malformedFrames_ = 0;
+  this->rttLatency_.reset();
+  this->setSpeedLatency_.reset();
+  this->pollLatency_.reset();
+  this->airwayLatency_.reset();
+  this->rf_->resetSpiStats();
+
+  this->publishMetrics();
+}
+
+void ZehnderRF::captureFrame(const CaptureDirection direction, const uint32_t time, const uint8_t *const pData,
+                             const uint8_t dataLength) {
+  CaptureRecord *pRecord;
+
+  if (this->capture_ == NULL) {
+    return;
+  }
+
+#ifdef USE_WEBSERVER
+  const std::lock_guard<std::mutex> lock(this->captureLock_);
+#endif
+
+  pRecord = &this->capture_[this->captureNext_];
+  pRecord->time = time;
+  pRecord->direction = direction;
+  pRecord->mode = this->rf_->getMode();
+  pRecord->state = this->state_;
+  pRecord->length = dataLength;
+  (void) memset(pRecord->frame, 0, FAN_FRAMESIZE);
+  (void) memcpy(pRecord->frame, pData, (dataLength < FAN_FRAMESIZE) ? dataLength : FAN_FRAMESIZE);
+
+  this->captureNext_ = (this->captureNext_ + 1) % this->captureSize_;
+  if (this->captureCount_ < this->captureSize_) {
+    ++this->captureCount_;
+  }
+}
+
+void ZehnderRF::captureHeader(uint8_t *const pHeader, const uint16_t count) {
+  pHeader[0] = 'Z';
+  pHeader[1] = 'R';
+  pHeader[2] = 'F';
+  pHeader[3] = 'C';
+  pHeader[4] = FAN_CAPTURE_VERSION;
+  pHeader[5] = sizeof(CaptureRecord);
+  pHeader[6] = (uint8_t) (count & 0xFF);
+  pHeader[7] = (uint8_t) (count >> 8);
+}
+
+// Bytes readCapture() needs for the whole capture, 0 when disabled
+size_t ZehnderRF::captureImageSize(void) const {
+  if (this->capture_ == NULL) {
+    return 0;
+  }
+  return FAN_CAPTURE_HEADER + (this->captureSize_ * sizeof(CaptureRecord));
+}
+
+// Copy the capture in its binary format: header, then the most recent records that fit, oldest first
+size_t ZehnderRF::readCapture(uint8_t *const pBuffer, const size_t bufferSize) {
+  uint16_t count;
+  uint16_t first;
+
+  if ((this->capture_ == NULL) || (bufferSize < FAN_CAPTURE_HEADER)) {
+    return 0;
+  }
+
+#ifdef USE_WEBSERVER
+  const std::lock_guard<std::mutex> lock(this->captureLock_);
+#endif
+
+  count = this->captureCount_;
+  if (count > ((bufferSize - FAN_CAPTURE_HEADER) / sizeof(CaptureRecord))) {
+    count = (bufferSize - FAN_CAPTURE_HEADER) / sizeof(CaptureRecord);
+  }
+  first = (this->captureNext_ + this->captureSize_ - count) % this->captureSize_;
+
+  this->captureHeader(pBuffer, count);
+  for (uint16_t i = 0; i < count; ++i) {
+    (void) memcpy(&pBuffer[FAN_CAPTURE_HEADER + (i * sizeof(CaptureRecord))],
+                  &this->capture_[(first + i) % this->captureSize_], sizeof(CaptureRecord));
+  }
+
+  return FAN_CAPTURE_HEADER + (count * sizeof(CaptureRecord));
+}
+
+// Log the capture as hex lines, for when only the log is at hand; the web_server download is the binary itself
+void ZehnderRF::dump_capture(void) {
+  uint8_t header[FAN_CAPTURE_HEADER];
+  uint16_t first;
+
+  if (this->capture_ == NULL) {
+    ESP_LOGW(TAG, "Frame capture disabled, set capture_size");
+    return;
+  }
+
+  // Oldest record first
+  this->captureHeader(header, this->captureCount_);
+  first = (this->captureNext_ + this->captureSize_ - this->captureCount_) % this->captureSize_;
+
+  nrf905::HexDump dump(TAG, "capture");
+  dump.write(header, sizeof(header));
+  for (uint16_t i = 0; i < this->captureCount_; ++i) {
+    dump.write((const uint8_t *) &this->capture_[(first + i) % this->captureSize_], sizeof(CaptureRecord));
+  }
+  dump.end();
+}
+
+#ifdef USE_WEBSERVER
+void CaptureHandler::handleRequest(AsyncWebServerRequest *request) {
+  AsyncResponseStream *pStream;
+  uint8_t *pImage;
+  size_t length;
+
+  // Snapshot first, the radio keeps recording while the response goes out
+  pImage = new uint8_t[this->fan_->captureImageSize()];
+  length = this->fan_->readCapture(pImage, this->fan_->captureImageSize());
+
+  pStream = request->beginResponseStream("application/octet-stream");
+  pStream->addHeader("Content-Disposition", "attachment; filename=\"capture.zrfc\"");
+  pStream->write(pImage, length);
+  delete[] pImage;
+
+  request->send(pStream);
 }
+#endif
 
 void ZehnderRF::loop(void) {
+  const nrf905::RxFrame *pFrame;
   uint8_t deviceId;
-  nrf905::Config rfConfig;
+
+  // Handle everything received since the last pass before looking at timeouts
+  while ((pFrame = this->rf_->peekRxFrame()) != NULL) {
+    ESP_LOGV(TAG, "Received frame");
+    this->captureFrame(CaptureRx, pFrame->timeUs, pFrame->payload, pFrame->length);
+    this->rxTime_ = pFrame->time;
+    this->rfHandleReceived(pFrame->payload, pFrame->length);
+    this->rf_->releaseRxFrame();
+  }
 
   // Run RF handler
   this->rfHandler();
 
+  this->expireCommands();
+
   switch (this->state_) {
     case StateStartup:
-      // Wait until started up
-      if (millis() > 15000) {
-        // Discovery?
-        if ((this->config_.fan_networkId == 0x00000000) || (this->config_.fan_my_device_type == 0) ||
-            (this->config_.fan_my_device_id == 0) || (this->config_.fan_main_unit_type == 0) ||
-            (this->config_.fan_main_unit_id == 0)) {
-          ESP_LOGD(TAG, "Invalid config, start paring");
-
-          this->state_ = StateStartDiscovery;
-        } else {
-          ESP_LOGD(TAG, "Config data valid, start polling");
+      // Radio and preferences are set up by now, the radio addresses already match the config
+      if (this->configValid() == false) {
+        ESP_LOGD(TAG, "Invalid config, start paring");
 
-          rfConfig = this->rf_->getConfig();
-          rfConfig.rx_address = this->config_.fan_networkId;
-          this->rf_->updateConfig(&rfConfig);
-          this->rf_->writeTxAddress(this->config_.fan_networkId);
+        this->pairingStartTime_ = millis();
+        this->state_ = StateStartDiscovery;
+      } else {
+        ESP_LOGD(TAG, "Config data valid, start polling");
 
-          // Start with query
-          this->queryDevice();
-        }
+        // Start with query
+        this->queryDevice();
       }
       break;
 
@@ -199,12 +393,28 @@ void ZehnderRF::loop(void) {
       break;
 
     case StateIdle:
-      if (newSetting == true) {
-        this->setSpeed(newSpeed, newTimer);
-      } else {
-        if ((millis() - this->lastFanQuery_) > this->interval_) {
-          this->queryDevice();
-        }
+      if ((millis() - this->lastFanState_) > this->pollDelay()) {
+        this->queueCommand(CommandQuery);
+      }
+      this->runCommandQueue();
+
+      // Nothing in flight; leave Receive unless configured to keep listening to other remotes
+      if ((this->rfState_ == RfStateIdle) && (this->rf_->getMode() != this->idleMode_)) {
+        this->rf_->setMode(this->idleMode_);
+      }
+      break;
+
+    case StateWaitQueryResponse:
+      // A user command doesn't wait for a poll; drop the poll only while it never went on air, else its reply
+      // could still arrive and be taken for the answer to the user command
+      if ((this->userCommandPending() == true) && (this->txAttempt_ == 0) &&
+          (this->rfState_ == RfStateWaitAirwayFree)) {
+        ESP_LOGD(TAG, "Preempt poll for user command");
+        this->rfAbort();
+        this->lastFanState_ = millis();
+
+        this->state_ = StateIdle;
+        this->runCommandQueue();
       }
       break;
 
@@ -220,10 +430,22 @@ void ZehnderRF::loop(void) {
 }
 
 void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataLength) {
-  const RfFrame *const pResponse = (RfFrame *) pData;
-  RfFrame *const pTxFrame = (RfFrame *) this->_txFrame;  // frame helper
+  const RfFrame *const pResponse = rfFrameDecode(pData, dataLength);
   nrf905::Config rfConfig;
 
+  // Nothing below looks at a frame that is too short or lacks the parameters of its command
+  if (pResponse == NULL) {
+    ++this->malformedFrames_;
+    ESP_LOGD(TAG, "Drop malformed frame; %u bytes", dataLength);
+    return;
+  }
+
+  if (this->isDuplicate(pData, dataLength) == true) {
+    ESP_LOGV(TAG, "Drop duplicate frame; type 0x%02X from ID 0x%02X", pResponse->command, pResponse->tx_id);
+    return;
+  }
+  this->countFrame(this->rxFrames_, pResponse->command);
+
   ESP_LOGD(TAG, "Current state: 0x%02X", this->state_);
   switch (this->state_) {
     case StateDiscoveryWaitForLinkRequest:
@@ -236,18 +458,9 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
 
           this->rfComplete();
 
-          (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);  // Clear frame data
-
-          // Found a main unit, so send a join request
-          pTxFrame->rx_type = FAN_TYPE_MAIN_UNIT;  // Set type to main unit
-          pTxFrame->rx_id = pResponse->tx_id;      // Set ID to the ID of the main unit
-          pTxFrame->tx_type = this->config_.fan_my_device_type;
-          pTxFrame->tx_id = this->config_.fan_my_device_id;
-          pTxFrame->ttl = FAN_TTL;
-          pTxFrame->command = FAN_NETWORK_JOIN_REQUEST;  // Request to connect to network
-          pTxFrame->parameter_count = sizeof(RfPayloadNetworkJoinOpen);
-          // Request to connect to the received network ID
-          pTxFrame->payload.networkJoinRequest.networkId = pResponse->payload.networkJoinOpen.networkId;
+          // Found a main unit, so request to connect to the received network ID
+          rfBuildJoinRequest(this->_txFrame, this->routeTo(FAN_TYPE_MAIN_UNIT, pResponse->tx_id),
+                             pResponse->payload.networkJoinOpen.networkId);
 
           // Store for later
           this->config_.fan_networkId = pResponse->payload.networkJoinOpen.networkId;
@@ -261,10 +474,7 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
           this->rf_->writeTxAddress(pResponse->payload.networkJoinOpen.networkId, NULL);
 
           // Send response frame
-          this->startTransmit(this->_txFrame, FAN_TX_RETRIES, [this]() {
-            ESP_LOGW(TAG, "Query Timeout");
-            this->state_ = StateStartDiscovery;
-          });
+          this->startTransmit(this->_txFrame, FAN_TX_RETRIES, &ZehnderRF::onDiscoveryTimeout);
 
           this->state_ = StateDiscoveryWaitForJoinResponse;
           break;
@@ -289,21 +499,10 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
 
             this->rfComplete();
 
-            (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);  // Clear frame data
-
-            pTxFrame->rx_type = FAN_TYPE_MAIN_UNIT;  // Set type to main unit
-            pTxFrame->rx_id = pResponse->tx_id;      // Set ID to the ID of the main unit
-            pTxFrame->tx_type = this->config_.fan_my_device_type;
-            pTxFrame->tx_id = this->config_.fan_my_device_id;
-            pTxFrame->ttl = FAN_TTL;
-            pTxFrame->command = FAN_FRAME_0B;  // 0x0B acknowledge link successful
-            pTxFrame->parameter_count = 0x00;  // No parameters
+            rfBuildLinkAck(this->_txFrame, this->routeTo(FAN_TYPE_MAIN_UNIT, pResponse->tx_id));
 
             // Send response frame
-            this->startTransmit(this->_txFrame, FAN_TX_RETRIES, [this]() {
-              ESP_LOGW(TAG, "Query Timeout");
-              this->state_ = StateStartDiscovery;
-            });
+            this->startTransmit(this->_txFrame, FAN_TX_RETRIES, &ZehnderRF::onDiscoveryTimeout);
 
             this->state_ = StateDiscoveryJoinComplete;
           } else {
@@ -333,6 +532,7 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
 
             ESP_LOGD(TAG, "Saving pairing config");
             this->pref_.save(&this->config_);
+            this->pairingLatency_.add(millis() - this->pairingStartTime_);
 
             this->state_ = StateIdle;
           } else {
@@ -358,12 +558,11 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
                      pResponse->payload.fanSettings.timer);
 
             this->rfComplete();
+            this->pollLatency_.add(millis() - this->lastFanQuery_);
 
-            this->state = pResponse->payload.fanSettings.speed > 0;
-            this->speed = pResponse->payload.fanSettings.speed;
-            this->timer = pResponse->payload.fanSettings.timer;
-            this->voltage = pResponse->payload.fanSettings.voltage;
-            this->publish_state();
+            this->activeCommandValid_ = false;
+            this->applyFanSettings(pResponse->payload.fanSettings.speed, pResponse->payload.fanSettings.voltage,
+                                   pResponse->payload.fanSettings.timer);
 
             this->state_ = StateIdle;
             break;
@@ -373,7 +572,7 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
                      pResponse->tx_id);
             break;
         }
-      } else {
+      } else if (this->rfHandleOverheard(pResponse) == false) {
         ESP_LOGD(TAG, "Received frame from unknown device; type 0x%02X from ID 0x%02X type 0x%02X", pResponse->command,
                  pResponse->tx_id, pResponse->tx_type);
       }
@@ -388,26 +587,22 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
                      pResponse->payload.fanSettings.speed, pResponse->payload.fanSettings.voltage,
                      pResponse->payload.fanSettings.timer);
 
+            // Settings before our set speed went out answer an earlier poll, other settings are not ours to confirm
+            if (((this->txAttempt_ == 0) && (this->rfState_ != RfStateRxWait)) ||
+                (pResponse->payload.fanSettings.speed != this->activeCommand_.speed)) {
+              ESP_LOGD(TAG, "Fan settings don't confirm set speed %u, still waiting", this->activeCommand_.speed);
+              break;
+            }
+
             this->rfComplete();
+            this->setSpeedLatency_.add(millis() - this->setSpeedTime_);
 
-            this->state = pResponse->payload.fanSettings.speed > 0;
-            this->speed = pResponse->payload.fanSettings.speed;
-            this->timer = pResponse->payload.fanSettings.timer;
-            this->voltage = pResponse->payload.fanSettings.voltage;
-            this->publish_state();
-
-            (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);  // Clear frame data
-
-            pTxFrame->rx_type = this->config_.fan_main_unit_type;  // Set type to main unit
-            pTxFrame->rx_id = this->config_.fan_main_unit_id;      // Set ID to the ID of the main unit
-            pTxFrame->tx_type = this->config_.fan_my_device_type;
-            pTxFrame->tx_id = this->config_.fan_my_device_id;
-            pTxFrame->ttl = FAN_TTL;
-            pTxFrame->command = FAN_FRAME_SETSPEED_REPLY;  // 0x0B acknowledge link successful
-            pTxFrame->parameter_count = 0x03;              // 3 parameters
-            pTxFrame->payload.parameters[0] = 0x54;
-            pTxFrame->payload.parameters[1] = 0x03;
-            pTxFrame->payload.parameters[2] = 0x20;
+            this->activeCommandValid_ = false;
+            this->applyFanSettings(pResponse->payload.fanSettings.speed, pResponse->payload.fanSettings.voltage,
+                                   pResponse->payload.fanSettings.timer);
+
+            rfBuildSetSpeedReply(this->_txFrame,
+                                 this->routeTo(this->config_.fan_main_unit_type, this->config_.fan_main_unit_id));
 
             // Send response frame
             this->startTransmit(this->_txFrame, -1, NULL);
@@ -427,16 +622,111 @@ void ZehnderRF::rfHandleReceived(const uint8_t *const pData, const uint8_t dataL
                      pResponse->tx_id);
             break;
         }
-      } else {
+      } else if (this->rfHandleOverheard(pResponse) == false) {
         ESP_LOGD(TAG, "Received frame from unknown device; type 0x%02X from ID 0x%02X type 0x%02X", pResponse->command,
                  pResponse->tx_id, pResponse->tx_type);
       }
       break;
 
     default:
-      ESP_LOGD(TAG, "Received frame from unknown device in unknown state; type 0x%02X from ID 0x%02X type 0x%02X",
-               pResponse->command, pResponse->tx_id, pResponse->tx_type);
+      if (this->rfHandleOverheard(pResponse) == false) {
+        ESP_LOGD(TAG, "Received frame from unknown device in unknown state; type 0x%02X from ID 0x%02X type 0x%02X",
+                 pResponse->command, pResponse->tx_id, pResponse->tx_type);
+      }
+      break;
+  }
+}
+
+bool ZehnderRF::rfHandleOverheard(const RfFrame *const pFrame) {
+  // Only once paired; the RX address keeps other networks out
+  if ((this->state_ < StateIdle) || (this->state_ >= StateNrOf)) {
+    return false;
+  }
+  // Our own traffic is handled by the state machine
+  if ((pFrame->rx_type == this->config_.fan_my_device_type) && (pFrame->rx_id == this->config_.fan_my_device_id)) {
+    return false;
+  }
+
+  switch (pFrame->command) {
+    case FAN_TYPE_FAN_SETTINGS:
+      // Main unit telling another remote its settings
+      if ((pFrame->tx_type != this->config_.fan_main_unit_type) || (pFrame->tx_id != this->config_.fan_main_unit_id)) {
+        return false;
+      }
+      ESP_LOGD(TAG, "Overheard fan settings for ID 0x%02X; speed: 0x%02X voltage: %i timer: %i", pFrame->rx_id,
+               pFrame->payload.fanSettings.speed, pFrame->payload.fanSettings.voltage,
+               pFrame->payload.fanSettings.timer);
+
+      this->applyFanSettings(pFrame->payload.fanSettings.speed, pFrame->payload.fanSettings.voltage,
+                             pFrame->payload.fanSettings.timer);
+      break;
+
+    case FAN_FRAME_SETSPEED:
+    case FAN_FRAME_SETTIMER:
+      // Another remote changing the speed; the fan confirms with its settings later on
+      if (pFrame->rx_type != this->config_.fan_main_unit_type) {
+        return false;
+      }
+      ESP_LOGD(TAG, "Overheard set speed from ID 0x%02X; speed: 0x%02X", pFrame->tx_id,
+               pFrame->payload.setSpeed.speed);
+
+      this->state = pFrame->payload.setSpeed.speed > 0;
+      this->speed = pFrame->payload.setSpeed.speed;
+      this->timer = (pFrame->command == FAN_FRAME_SETTIMER) ? pFrame->payload.setTimer.timer : 0;
+      this->modelTimer((pFrame->command == FAN_FRAME_SETTIMER) ? pFrame->payload.setTimer.timer : 0);
+      this->pollFast_ = true;  // Confirm in case the settings reply is missed
+      this->publish_state();
       break;
+
+    default:
+      return false;
+  }
+
+  ++this->overheardFrames_;
+
+  // Fresh state, no need to ask for it soon; lastFanQuery_ stays, a poll in flight is still measured from its start
+  this->lastFanState_ = millis();
+
+  return true;
+}
+
+bool ZehnderRF::isDuplicate(const uint8_t *const pData, const uint8_t dataLength) {
+  const uint32_t now = millis();
+
+  if (dataLength < FAN_FRAMESIZE) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < FAN_DUPLICATE_CACHE; ++i) {
+    RecentFrame *const pRecent = &this->recentFrames_[i];
+
+    if (((now - pRecent->time) < FAN_DUPLICATE_WINDOW) && (memcmp(pRecent->frame, pData, FAN_FRAMESIZE) == 0)) {
+      // Keep a burst of retransmissions suppressed for as long as it lasts
+      pRecent->time = now;
+      ++this->duplicateFrames_;
+      return true;
+    }
+  }
+
+  // New frame, replace the oldest entry
+  (void) memcpy(this->recentFrames_[this->recentFrameIndex_].frame, pData, FAN_FRAMESIZE);
+  this->recentFrames_[this->recentFrameIndex_].time = now;
+  this->recentFrameIndex_ = (this->recentFrameIndex_ + 1) % FAN_DUPLICATE_CACHE;
+
+  return false;
+}
+
+void ZehnderRF::forgetRepliesToUs(void) {
+  const uint32_t now = millis();
+
+  for (uint8_t i = 0; i < FAN_DUPLICATE_CACHE; ++i) {
+    RecentFrame *const pRecent = &this->recentFrames_[i];
+    const RfFrame *const pFrame = (const RfFrame *) pRecent->frame;
+
+    // Overheard frames stay, their retransmissions still need to be suppressed
+    if ((pFrame->rx_type == this->config_.fan_my_device_type) && (pFrame->rx_id == this->config_.fan_my_device_id)) {
+      pRecent->time = now - FAN_DUPLICATE_WINDOW;  // Expired
+    }
   }
 }
 
@@ -450,6 +740,17 @@ static uint8_t minmax(const uint8_t value, const uint8_t min, const uint8_t max)
   }
 }
 
+RfRoute ZehnderRF::routeTo(const uint8_t rxType, const uint8_t rxId) {
+  RfRoute route;
+
+  route.rx_type = rxType;
+  route.rx_id = rxId;
+  route.tx_type = this->config_.fan_my_device_type;
+  route.tx_id = this->config_.fan_my_device_id;
+
+  return route;
+}
+
 uint8_t ZehnderRF::createDeviceID(void) {
   uint8_t random = (uint8_t) random_uint32();
   // Generate random device_id; don't use 0x00 and 0xFF
@@ -461,34 +762,31 @@ uint8_t ZehnderRF::createDeviceID(void) {
 }
 
 void ZehnderRF::queryDevice(void) {
-  RfFrame *const pFrame = (RfFrame *) this->_txFrame;  // frame helper
-
   ESP_LOGD(TAG, "Query device");
+  this->rf_->traceMark(TraceMarkPoll);
 
   this->lastFanQuery_ = millis();  // Update time
+  this->lastFanState_ = this->lastFanQuery_;
 
-  // Clear frame data
-  (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);
+  rfBuildQueryDevice(this->_txFrame, this->routeTo(this->config_.fan_main_unit_type, this->config_.fan_main_unit_id));
 
-  // Build frame
-  pFrame->rx_type = this->config_.fan_main_unit_type;
-  pFrame->rx_id = this->config_.fan_main_unit_id;
-  pFrame->tx_type = this->config_.fan_my_device_type;
-  pFrame->tx_id = this->config_.fan_my_device_id;
-  pFrame->ttl = FAN_TTL;
-  pFrame->command = FAN_TYPE_QUERY_DEVICE;
-  pFrame->parameter_count = 0x00;  // No parameters
-
-  this->startTransmit(this->_txFrame, FAN_TX_RETRIES, [this]() {
-    ESP_LOGW(TAG, "Query Timeout");
-    this->state_ = StateIdle;
-  });
+  this->startTransmit(this->_txFrame, FAN_TX_RETRIES, &ZehnderRF::onQueryTimeout);
 
   this->state_ = StateWaitQueryResponse;
 }
 
+void ZehnderRF::onQueryTimeout(void) {
+  ESP_LOGW(TAG, "Query Timeout");
+  this->pollFailed();
+  this->state_ = StateIdle;
+}
+
 void ZehnderRF::setSpeed(const uint8_t paramSpeed, const uint8_t paramTimer) {
-  RfFrame *const pFrame = (RfFrame *) this->_txFrame;  // frame helper
+  this->requestSpeed(paramSpeed, paramTimer, false);
+}
+
+void ZehnderRF::requestSpeed(const uint8_t paramSpeed, const uint8_t paramTimer, const bool guaranteed) {
+  Command command;
   uint8_t speed = paramSpeed;
   uint8_t timer = paramTimer;
 
@@ -499,44 +797,300 @@ void ZehnderRF::setSpeed(const uint8_t paramSpeed, const uint8_t paramTimer) {
 
   ESP_LOGD(TAG, "Set speed: 0x%02X; Timer %u minutes", speed, timer);
 
+  // Latency is measured from the request, including any wait in the queue
+  this->setSpeedTime_ = millis();
+
+  command.type = CommandSetSpeed;
+  command.speed = speed;
+  command.timer = timer;
+  command.queueTime = this->setSpeedTime_;
+  command.guaranteed = guaranteed;
+  this->queueCommand(command);
   if (this->state_ == StateIdle) {
-    (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);  // Clear frame data
-
-    // Build frame
-    pFrame->rx_type = this->config_.fan_main_unit_type;
-    pFrame->rx_id = 0x00;  // Broadcast
-    pFrame->tx_type = this->config_.fan_my_device_type;
-    pFrame->tx_id = this->config_.fan_my_device_id;
-    pFrame->ttl = FAN_TTL;
-
-    if (timer == 0) {
-      pFrame->command = FAN_FRAME_SETSPEED;
-      pFrame->parameter_count = sizeof(RfPayloadFanSetSpeed);
-      pFrame->payload.setSpeed.speed = speed;
+    this->runCommandQueue();
+  } else {
+    ESP_LOGD(TAG, "Busy, queued set speed");
+  }
+}
+
+void ZehnderRF::sendSpeed(const uint8_t speed, const uint8_t timer) {
+  const RfRoute route = this->routeTo(this->config_.fan_main_unit_type, 0x00);  // Broadcast
+
+  if (timer == 0) {
+    rfBuildSetSpeed(this->_txFrame, route, speed);
+  } else {
+    rfBuildSetTimer(this->_txFrame, route, speed, timer);
+  }
+
+  this->startTransmit(this->_txFrame, FAN_TX_RETRIES, &ZehnderRF::onSetSpeedTimeout);
+
+  this->state_ = StateWaitSetSpeedResponse;
+}
+
+void ZehnderRF::onSetSpeedTimeout(void) {
+  ESP_LOGW(TAG, "Set speed timeout");
+  this->state_ = StateIdle;
+  this->retryActiveCommand();
+}
+
+void ZehnderRF::applyFanSettings(const uint8_t speed, const uint8_t voltage, const uint8_t timer) {
+  const int timerDrift = (int) timer - (int) this->get_timer_remaining();
+  // The timer counts down between polls, so only a jump of more than a minute is a change
+  const bool changed = (this->confirmed_ == false) || (speed != this->confirmedSpeed_) ||
+                       (voltage != this->confirmedVoltage_) || ((timer == 0) != (this->timerRunning_ == false)) ||
+                       (timerDrift > 1) || (timerDrift < -1);
+
+  this->pollSucceeded(changed);
+  // Whole minutes only; a model that still rounds to what the fan reports is the sharper one, keep it
+  if ((timerDrift != 0) || ((timer == 0) != (this->timerRunning_ == false))) {
+    this->modelTimer(timer);
+  }
+  this->stateStale_ = false;
+
+  // The timer is not restored, after a reboot it can't be known how much of it is left
+  if ((speed != this->savedState_.speed) || (voltage != this->savedState_.voltage)) {
+    this->savedState_.speed = speed;
+    this->savedState_.voltage = voltage;
+    this->statePref_.save(&this->savedState_);
+  }
+
+  this->confirmed_ = true;
+  this->confirmedSpeed_ = speed;
+  this->confirmedVoltage_ = voltage;
+  this->confirmedTimer_ = timer;
+
+  this->state = speed > 0;
+  this->speed = speed;
+  this->timer = timer;
+  this->voltage = voltage;
+  this->publish_state();
+}
+
+bool ZehnderRF::configValid(void) {
+  return (this->config_.fan_networkId != 0x00000000) && (this->config_.fan_my_device_type != 0) &&
+         (this->config_.fan_my_device_id != 0) && (this->config_.fan_main_unit_type != 0) &&
+         (this->config_.fan_main_unit_id != 0);
+}
+
+uint8_t ZehnderRF::get_timer_remaining(void) {
+  const int32_t remaining = (int32_t) (this->timerEnd_ - millis());
+
+  if ((this->timerRunning_ == false) || (remaining <= 0)) {
+    return 0;
+  }
+
+  return (remaining + 59999) / 60000;  // Whole minutes, like the fan reports them
+}
+
+void ZehnderRF::modelTimer(const uint8_t minutes) {
+  this->timerRunning_ = minutes > 0;
+  this->timerEnd_ = millis() + (minutes * 60000);
+}
+
+uint32_t ZehnderRF::pollDelay(void) {
+  uint32_t delay = this->pollInterval_;
+
+  if ((this->pollFast_ == true) && (delay > FAN_POLL_FAST)) {
+    delay = FAN_POLL_FAST;
+  }
+
+  // The fan changes speed by itself when the timer runs out; don't sleep through that. Not while the fan is
+  // unreachable though, the backoff wins then.
+  if ((this->timerRunning_ == true) && (this->pollFailures_ == 0)) {
+    const int32_t untilTimerEnd = (int32_t) (this->timerEnd_ + FAN_POLL_TIMER_MARGIN - this->lastFanState_);
+
+    if (untilTimerEnd <= 0) {
+      delay = 0;
+    } else if ((uint32_t) untilTimerEnd < delay) {
+      delay = untilTimerEnd;
+    }
+  }
+
+  return delay;
+}
+
+void ZehnderRF::pollSucceeded(const bool changed) {
+  if ((changed == true) || (this->pollFailures_ > 0)) {
+    // Start over from the configured interval
+    this->pollInterval_ = this->interval_;
+  } else {
+    // Stable, stretch the interval by half up to the maximum
+    this->pollInterval_ += this->pollInterval_ / 2;
+    if (this->pollInterval_ > this->maxInterval_) {
+      this->pollInterval_ = this->maxInterval_;
+    }
+  }
+  this->pollFast_ = changed;
+  this->pollFailures_ = 0;
+}
+
+void ZehnderRF::pollFailed(void) {
+  if (this->pollFailures_ < UINT8_MAX) {
+    ++this->pollFailures_;
+  }
+  this->pollFast_ = false;
+
+  // Exponential backoff while the fan doesn't answer
+  this->pollInterval_ = this->interval_;
+  for (uint8_t i = 0; (i < this->pollFailures_) && (this->pollInterval_ < this->maxInterval_); ++i) {
+    this->pollInterval_ <<= 1;
+  }
+  if (this->pollInterval_ > this->maxInterval_) {
+    this->pollInterval_ = this->maxInterval_;
+  }
+
+  ESP_LOGD(TAG, "Fan unreachable (%u polls), next poll in %u ms", this->pollFailures_, this->pollInterval_);
+}
+
+void ZehnderRF::queueCommand(const CommandType type) {
+  Command command;
+
+  command.type = type;
+  command.speed = 0;
+  command.timer = 0;
+  command.queueTime = millis();
+  command.guaranteed = false;
+
+  this->queueCommand(command);
+}
+
+void ZehnderRF::queueCommand(const Command &command) {
+  const CommandPriority priority = (command.type == CommandQuery) ? PriorityPoll : PriorityUser;
+  uint8_t index;
+
+  // Everything goes to the main unit, so a newer command supersedes a queued one of the same type
+  for (index = 0; index < this->commandCount_; ++index) {
+    if (this->commandQueue_[index].type == command.type) {
+      this->commandQueue_[index] = command;
+      this->commandQueue_[index].priority = priority;
+      return;
+    }
+  }
+
+  // Insert behind all commands of the same or a higher priority
+  index = this->commandCount_;
+  while ((index > 0) && (this->commandQueue_[index - 1].priority < priority)) {
+    this->commandQueue_[index] = this->commandQueue_[index - 1];
+    --index;
+  }
+  this->commandQueue_[index] = command;
+  this->commandQueue_[index].priority = priority;
+  ++this->commandCount_;
+}
+
+bool ZehnderRF::userCommandPending(void) {
+  return (this->commandCount_ > 0) && (this->commandQueue_[0].priority > PriorityPoll);
+}
+
+void ZehnderRF::runCommandQueue(void) {
+  Command command;
+
+  if ((this->commandCount_ == 0) || (this->rfState_ != RfStateIdle)) {
+    return;
+  }
+
+  // Pop the head
+  command = this->commandQueue_[0];
+  --this->commandCount_;
+  for (uint8_t i = 0; i < this->commandCount_; ++i) {
+    this->commandQueue_[i] = this->commandQueue_[i + 1];
+  }
+
+  this->activeCommand_ = command;
+  this->activeCommandValid_ = true;
+
+  switch (command.type) {
+    case CommandQuery:
+      this->queryDevice();
+      break;
+
+    case CommandSetSpeed:
+      this->sendSpeed(command.speed, command.timer);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void ZehnderRF::expireCommands(void) {
+  const uint32_t now = millis();
+  uint8_t index = 0;
+
+  while (index < this->commandCount_) {
+    if ((this->commandQueue_[index].guaranteed == true) &&
+        ((now - this->commandQueue_[index].queueTime) >= this->commandTimeout_)) {
+      const Command command = this->commandQueue_[index];
+
+      --this->commandCount_;
+      for (uint8_t i = index; i < this->commandCount_; ++i) {
+        this->commandQueue_[i] = this->commandQueue_[i + 1];
+      }
+
+      this->commandFailed(command);
     } else {
-      pFrame->command = FAN_FRAME_SETTIMER;
-      pFrame->parameter_count = sizeof(RfPayloadFanSetTimer);
-      pFrame->payload.setTimer.speed = speed;
-      pFrame->payload.setTimer.timer = timer;
+      ++index;
     }
+  }
+
+  // The deadline holds for the transaction in flight as well; let a frame on air finish first
+  if ((this->activeCommandValid_ == true) && (this->activeCommand_.guaranteed == true) &&
+      (this->state_ == StateWaitSetSpeedResponse) && (this->rfState_ != RfStateTxBusy) &&
+      ((now - this->activeCommand_.queueTime) >= this->commandTimeout_)) {
+    this->rfAbort();
+    this->activeCommandValid_ = false;
+    this->state_ = StateIdle;
+
+    this->commandFailed(this->activeCommand_);
+  }
+}
+
+void ZehnderRF::retryActiveCommand(void) {
+  if (this->activeCommandValid_ == false) {
+    return;
+  }
+  this->activeCommandValid_ = false;
+
+  if (this->activeCommand_.guaranteed == false) {
+    return;
+  }
 
-    this->startTransmit(this->_txFrame, FAN_TX_RETRIES, [this]() {
-      ESP_LOGW(TAG, "Set speed timeout");
-      this->state_ = StateIdle;
-    });
+  if ((millis() - this->activeCommand_.queueTime) >= this->commandTimeout_) {
+    this->commandFailed(this->activeCommand_);
+    return;
+  }
+
+  // Try again, unless a newer command of the same type took its place meanwhile
+  for (uint8_t i = 0; i < this->commandCount_; ++i) {
+    if (this->commandQueue_[i].type == this->activeCommand_.type) {
+      return;
+    }
+  }
+  ESP_LOGD(TAG, "Retry command %u", this->activeCommand_.type);
+  this->queueCommand(this->activeCommand_);
+}
 
-    newSetting = false;
-    this->state_ = StateWaitSetSpeedResponse;
+void ZehnderRF::commandFailed(const Command &command) {
+  ESP_LOGW(TAG, "Set speed 0x%02X not confirmed within %u ms", command.speed, this->commandTimeout_);
+  ++this->failedCommands_;
+
+  // Show what the fan really does. Before the fan ever answered that is unknown: show it off, and stale until a
+  // poll gets through.
+  if (this->confirmed_ == true) {
+    this->state = this->confirmedSpeed_ > 0;
+    this->speed = this->confirmedSpeed_;
+    this->timer = this->confirmedTimer_;
+    this->voltage = this->confirmedVoltage_;
   } else {
-    ESP_LOGD(TAG, "Invalid state, I'm trying later again");
-    newSpeed = speed;
-    newTimer = timer;
-    newSetting = true;
+    this->state = false;
+    this->speed = 0;
+    this->timer = false;
+    this->stateStale_ = true;
   }
+  this->publish_state();
 }
 
 void ZehnderRF::discoveryStart(const uint8_t deviceId) {
-  RfFrame *const pFrame = (RfFrame *) this->_txFrame;  // frame helper
   nrf905::Config rfConfig;
 
   ESP_LOGD(TAG, "Start discovery with ID %u", deviceId);
@@ -544,18 +1098,8 @@ void ZehnderRF::discoveryStart(const uint8_t deviceId) {
   this->config_.fan_my_device_type = FAN_TYPE_REMOTE_CONTROL;
   this->config_.fan_my_device_id = deviceId;
 
-  // Build frame
-  (void) memset(this->_txFrame, 0, FAN_FRAMESIZE);  // Clear frame data
-
-  // Set payload, available for linking
-  pFrame->rx_type = 0x04;
-  pFrame->rx_id = 0x00;
-  pFrame->tx_type = this->config_.fan_my_device_type;
-  pFrame->tx_id = this->config_.fan_my_device_id;
-  pFrame->ttl = FAN_TTL;
-  pFrame->command = FAN_NETWORK_JOIN_ACK;
-  pFrame->parameter_count = sizeof(RfPayloadNetworkJoinAck);
-  pFrame->payload.networkJoinAck.networkId = NETWORK_LINK_ID;
+  // Available for linking
+  rfBuildJoinAck(this->_txFrame, this->routeTo(0x04, 0x00), NETWORK_LINK_ID);
 
   // Set RX and TX address
   rfConfig = this->rf_->getConfig();
@@ -563,27 +1107,29 @@ void ZehnderRF::discoveryStart(const uint8_t deviceId) {
   this->rf_->updateConfig(&rfConfig, NULL);
   this->rf_->writeTxAddress(NETWORK_LINK_ID, NULL);
 
-  this->startTransmit(this->_txFrame, FAN_TX_RETRIES, [this]() {
-    ESP_LOGW(TAG, "Start discovery timeout");
-    this->state_ = StateStartDiscovery;
-  });
+  this->startTransmit(this->_txFrame, FAN_TX_RETRIES, &ZehnderRF::onDiscoveryTimeout);
 
   // Update state
   this->state_ = StateDiscoveryWaitForLinkRequest;
 }
 
+void ZehnderRF::onDiscoveryTimeout(void) {
+  ESP_LOGW(TAG, "Discovery timeout in state 0x%02X", this->state_);
+  this->state_ = StateStartDiscovery;
+}
+
 Result ZehnderRF::startTransmit(const uint8_t *const pData, const int8_t rxRetries,
-                                const std::function<void(void)> callback) {
+                                const TimeoutHandler onTimeout) {
   Result result = ResultOk;
-  unsigned long startTime;
-  bool busy = true;
 
   if (this->rfState_ != RfStateIdle) {
     ESP_LOGW(TAG, "TX still ongoing");
     result = ResultBusy;
   } else {
-    this->onReceiveTimeout_ = callback;
+    this->onReceiveTimeout_ = onTimeout;
     this->retries_ = rxRetries;
+    this->txAttempt_ = 0;
+    this->transactionStartTime_ = millis();
 
     // Write data to RF
     // if (pData != NULL) {  // If frame given, load it in the nRF. Else use previous TX payload
@@ -591,59 +1137,210 @@ Result ZehnderRF::startTransmit(const uint8_t *const pData, const int8_t rxRetri
     this->rf_->writeTxPayload(pData, FAN_FRAMESIZE);  // Use framesize
     // }
 
-    this->rfState_ = RfStateWaitAirwayFree;
-    this->airwayFreeWaitTime_ = millis();
+    this->rfWaitAirwayFree();
   }
 
   return result;
 }
 
 void ZehnderRF::rfComplete(void) {
+  // Reply received; only a first attempt gives an unambiguous round trip. Measured up to the moment the radio
+  // delivered it, not when the loop got to it.
+  if ((this->rfState_ == RfStateRxWait) && ((int32_t) (this->rxTime_ - this->msgSendTime_) >= 0)) {
+    this->rttLatency_.add(this->rxTime_ - this->msgSendTime_);
+    if (this->txAttempt_ == 0) {
+      this->rttSample(this->rxTime_ - this->msgSendTime_);
+    }
+  }
+  if ((this->retries_ >= 0) && (this->txAttempt_ <= FAN_TX_RETRIES)) {
+    ++this->retryCounts_[this->txAttempt_];
+  }
+
+  this->rfAbort();
+}
+
+void ZehnderRF::rfAbort(void) {
   this->retries_ = -1;  // Disable this->retries_
   this->rfState_ = RfStateIdle;
 }
 
+ZehnderRF::RttClass ZehnderRF::rttClass(const uint8_t command) {
+  switch (command) {
+    case FAN_TYPE_QUERY_DEVICE:
+      return RttQuery;
+
+    case FAN_FRAME_SETVOLTAGE:
+    case FAN_FRAME_SETSPEED:
+    case FAN_FRAME_SETTIMER:
+      return RttSetSpeed;
+
+    case FAN_NETWORK_JOIN_REQUEST:
+    case FAN_FRAME_0B:
+      return RttJoin;
+
+    default:
+      return RttNrOf;
+  }
+}
+
+void ZehnderRF::rttSample(const uint32_t rtt) {
+  const RttClass rttClass = this->rttClass(((RfFrame *) this->_txFrame)->command);
+  RttEstimate *pEstimate;
+
+  if (rttClass == RttNrOf) {
+    return;
+  }
+  pEstimate = &this->rtt_[rttClass];
+
+  if (pEstimate->valid == false) {
+    pEstimate->srtt = rtt;
+    pEstimate->rttvar = rtt / 2;
+    pEstimate->valid = true;
+  } else {
+    const uint32_t delta = (rtt > pEstimate->srtt) ? (rtt - pEstimate->srtt) : (pEstimate->srtt - rtt);
+
+    pEstimate->rttvar = ((3 * pEstimate->rttvar) + delta) / 4;
+    pEstimate->srtt = ((7 * pEstimate->srtt) + rtt) / 8;
+  }
+
+  ESP_LOGV(TAG, "RTT %u ms; srtt %u rttvar %u", rtt, pEstimate->srtt, pEstimate->rttvar);
+}
+
+uint32_t ZehnderRF::rttTimeout(void) {
+  const RttClass rttClass = this->rttClass(((RfFrame *) this->_txFrame)->command);
+  uint32_t timeout = FAN_REPLY_TIMEOUT;
+
+  // Until a round trip has been measured the fixed timeout is already on the safe side; don't back off from it
+  if ((rttClass != RttNrOf) && (this->rtt_[rttClass].valid == true)) {
+    timeout = this->rtt_[rttClass].srtt + (4 * this->rtt_[rttClass].rttvar);
+    if (timeout < FAN_REPLY_TIMEOUT_MIN) {
+      timeout = FAN_REPLY_TIMEOUT_MIN;
+    }
+
+    // Exponential backoff over the retries
+    for (uint8_t i = 0; (i < this->txAttempt_) && (timeout < FAN_REPLY_TIMEOUT_MAX); ++i) {
+      timeout <<= 1;
+    }
+    if (timeout > FAN_REPLY_TIMEOUT_MAX) {
+      timeout = FAN_REPLY_TIMEOUT_MAX;
+    }
+  }
+
+  return timeout;
+}
+
+void ZehnderRF::rfWaitAirwayFree(void) {
+  this->rfState_ = RfStateWaitAirwayFree;
+  this->airwayFreeWaitTime_ = millis();
+  this->airwayCheckTime_ = this->airwayFreeWaitTime_;  // First carrier sense right away
+  this->backoffExponent_ = 0;
+
+  // Carrier detect only works in Receive; give the radio time to wake up and settle first. Without a CD pin there is
+  // nothing to sense, the radio goes to Transmit straight from the idle mode and startTx() handles the power-up.
+  if ((this->rf_->hasCarrierDetect() == true) && (this->rf_->getMode() != nrf905::Receive)) {
+    this->rf_->setMode(nrf905::Receive);
+    this->airwayCheckTime_ += FAN_RX_SETTLE;
+  }
+}
+
+void ZehnderRF::rfTxReady(void) {
+  ESP_LOGD(TAG, "Tx Ready");
+  if (this->rfState_ == RfStateTxBusy) {
+    if (this->retries_ >= 0) {
+      const uint32_t elapsed = millis() - this->transactionStartTime_;
+
+      // The answer to this request may repeat an earlier reply byte for byte (same settings); don't drop it. Copies
+      // of that earlier reply may still come in until the request is on air.
+      this->forgetRepliesToUs();
+      this->msgSendTime_ = millis();
+      this->replyTimeout_ = this->rttTimeout();
+
+      // Backoff doesn't stretch the transaction beyond FAN_TRANSACTION_TIMEOUT; the last wait gets what is left
+      if (elapsed >= FAN_TRANSACTION_TIMEOUT) {
+        this->replyTimeout_ = FAN_REPLY_TIMEOUT_MIN;
+      } else if (this->replyTimeout_ > (FAN_TRANSACTION_TIMEOUT - elapsed)) {
+        this->replyTimeout_ = FAN_TRANSACTION_TIMEOUT - elapsed;
+      }
+      this->rfState_ = RfStateRxWait;
+    } else {
+      this->rfState_ = RfStateIdle;
+    }
+  }
+}
+
+void ZehnderRF::rfTimeout(const bool airway) {
+  if (airway == true) {
+    // Never went on air; the retry statistics are about the replies to frames that did
+    ++this->airwayTimeouts_;
+  } else if (this->retries_ >= 0) {
+    ++this->retryCounts_[FAN_TX_RETRIES + 1];
+    if (this->state_ < StateNrOf) {
+      ++this->timeouts_[this->state_];
+    }
+  }
+
+  if (this->onReceiveTimeout_ != NULL) {
+    (this->*this->onReceiveTimeout_)();
+  }
+}
+
 void ZehnderRF::rfHandler(void) {
+  uint32_t now;
+
   switch (this->rfState_) {
     case RfStateIdle:
       break;
 
     case RfStateWaitAirwayFree:
-      if ((millis() - this->airwayFreeWaitTime_) > 5000) {
+      now = millis();
+      if ((now - this->airwayFreeWaitTime_) > FAN_AIRWAY_TIMEOUT) {
         ESP_LOGW(TAG, "Airway too busy, giving up");
         this->rfState_ = RfStateIdle;
 
-        if (this->onReceiveTimeout_ != NULL) {
-          this->onReceiveTimeout_();
+        this->rfTimeout(true);
+      } else if ((int32_t) (now - this->airwayCheckTime_) >= 0) {
+        if (this->rf_->airwayBusy() == false) {
+          ESP_LOGD(TAG, "Start TX");
+          this->airwayLatency_.add(now - this->airwayFreeWaitTime_);
+          this->countFrame(this->txFrames_, ((RfFrame *) this->_txFrame)->command);
+          this->captureFrame(CaptureTx, micros(), this->_txFrame, FAN_FRAMESIZE);
+          this->rf_->startTx(FAN_TX_FRAMES, nrf905::Receive);  // After transmit, wait for response
+
+          this->txStartTime_ = now;
+          this->rfState_ = RfStateTxBusy;
+        } else {
+          // Don't all jump on the carrier dropping; sense again after a random number of slots
+          if (this->backoffExponent_ < FAN_CSMA_MAX_EXPONENT) {
+            ++this->backoffExponent_;
+          }
+          this->airwayCheckTime_ = now + (((random_uint32() % (1 << this->backoffExponent_)) + 1) * FAN_CSMA_SLOT);
         }
-      } else if (this->rf_->airwayBusy() == false) {
-        ESP_LOGD(TAG, "Start TX");
-        this->rf_->startTx(FAN_TX_FRAMES, nrf905::Receive);  // After transmit, wait for response
-
-        this->rfState_ = RfStateTxBusy;
       }
       break;
 
     case RfStateTxBusy:
+      // TX ready never came; carry on as if the frame went out, the reply timeout and retries take it from there
+      if ((millis() - this->txStartTime_) > FAN_TX_TIMEOUT) {
+        ESP_LOGW(TAG, "TX ready timeout");
+        this->rfTxReady();
+      }
       break;
 
     case RfStateRxWait:
-      if ((this->retries_ >= 0) && ((millis() - this->msgSendTime_) > FAN_REPLY_TIMEOUT)) {
+      if ((this->retries_ >= 0) && ((millis() - this->msgSendTime_) > this->replyTimeout_)) {
         ESP_LOGD(TAG, "Receive timeout");
 
-        if (this->retries_ > 0) {
+        if ((this->retries_ > 0) && ((millis() - this->transactionStartTime_) < FAN_TRANSACTION_TIMEOUT)) {
           --this->retries_;
+          ++this->txAttempt_;
           ESP_LOGD(TAG, "No data received, retry again (left: %u)", this->retries_);
 
-          this->rfState_ = RfStateWaitAirwayFree;
-          this->airwayFreeWaitTime_ = millis();
-        } else if (this->retries_ == 0) {
+          this->rfWaitAirwayFree();
+        } else {
           // Oh oh, ran out of options
 
           ESP_LOGD(TAG, "No messages received, giving up now...");
-          if (this->onReceiveTimeout_ != NULL) {
-            this->onReceiveTimeout_();
-          }
+          this->rfTimeout(false);
 
           // Back to idle
           this->rfState_ = RfStateIdle;
@@ -5,41 +5,39 @@
 #include "esphome/core/hal.h"
 #include "esphome/components/spi/spi.h"
 #include "esphome/components/fan/fan_state.h"
+#include "esphome/components/sensor/sensor.h"
 #include "esphome/components/nrf905/nRF905.h"
+#include "histogram.h"
+#include "rf_frame.h"
+
+#ifdef USE_WEBSERVER
+#include <mutex>
+#include "esphome/components/web_server_base/web_server_base.h"
+#endif
 
 namespace esphome {
 namespace zehnder {
 
-#define FAN_FRAMESIZE 16        // Each frame consists of 16 bytes
-#define FAN_TX_FRAMES 4         // Retransmit every transmitted frame 4 times
-#define FAN_TX_RETRIES 10       // Retry transmission 10 times if no reply is received
-#define FAN_TTL 250             // 0xFA, default time-to-live for a frame
-#define FAN_REPLY_TIMEOUT 1000  // Wait 500ms for receiving a reply when doing a network scan
-
-/* Fan device types */
-enum {
-  FAN_TYPE_BROADCAST = 0x00,       // Broadcast to all devices
-  FAN_TYPE_MAIN_UNIT = 0x01,       // Fans
-  FAN_TYPE_REMOTE_CONTROL = 0x03,  // Remote controls
-  FAN_TYPE_CO2_SENSOR = 0x18
-};  // CO2 sensors
-
-/* Fan commands */
-enum {
-  FAN_FRAME_SETVOLTAGE = 0x01,  // Set speed (voltage / percentage)
-  FAN_FRAME_SETSPEED = 0x02,    // Set speed (preset)
-  FAN_FRAME_SETTIMER = 0x03,    // Set speed with timer
-  FAN_NETWORK_JOIN_REQUEST = 0x04,
-  FAN_FRAME_SETSPEED_REPLY = 0x05,
-  FAN_NETWORK_JOIN_OPEN = 0x06,
-  FAN_TYPE_FAN_SETTINGS = 0x07,  // Current settings, sent by fan in reply to 0x01, 0x02, 0x10
-  FAN_FRAME_0B = 0x0B,
-  FAN_NETWORK_JOIN_ACK = 0x0C,
-  // FAN_NETWORK_JOIN_FINISH = 0x0D,
-  FAN_TYPE_QUERY_NETWORK = 0x0D,
-  FAN_TYPE_QUERY_DEVICE = 0x10,
-  FAN_FRAME_SETVOLTAGE_REPLY = 0x1D
-};
+#define FAN_TX_FRAMES 4             // Send every frame 4 times in a burst
+#define FAN_TX_RETRIES 10           // Retry transmission 10 times if no reply is received
+#define FAN_REPLY_TIMEOUT 1000      // Wait 1000ms for a reply until round trips have been measured
+#define FAN_REPLY_TIMEOUT_MIN 50    // Lower bound of the measured reply timeout
+#define FAN_REPLY_TIMEOUT_MAX 4000  // Upper bound of the reply timeout, retry backoff included
+#define FAN_TRANSACTION_TIMEOUT ((FAN_TX_RETRIES + 1) * FAN_REPLY_TIMEOUT)  // Give up on a reply after 11s
+#define FAN_AIRWAY_TIMEOUT 5000     // Give up on a frame when the airway stays busy for 5s
+#define FAN_TX_TIMEOUT (MAX_TRANSMIT_TIME + 100)  // Radio reports TX ready by then, its own TX timeout included
+#define FAN_CSMA_SLOT 5             // Backoff slot when the airway is busy, about one frame on air (ms)
+#define FAN_CSMA_MAX_EXPONENT 6     // Backoff window doubles up to 2^6 slots
+#define FAN_DUPLICATE_CACHE 8       // Recently received frames kept to detect retransmissions
+#define FAN_DUPLICATE_WINDOW 300    // Same frame again within 300ms is a retransmission
+#define FAN_POLL_FAST 5000          // Poll again 5s after the fan reported a change
+#define FAN_POLL_TIMER_MARGIN 5000  // Poll 5s after the modelled timer runs out
+#define FAN_METRICS_INTERVAL 60000  // Publish metric sensors every minute
+#define FAN_COMMAND_SLOTS 0x20      // Per command counters; commands above 0x1F count in slot 0x00
+#define FAN_CAPTURE_VERSION 1       // Capture dump format: "ZRFC", version, record size, record count (LE16), records
+#define FAN_CAPTURE_HEADER 8        // Bytes before the first capture record
+#define FAN_CAPTURE_URL "/capture"  // web_server path of the binary capture download
+#define FAN_RX_SETTLE 5             // Carrier detect is valid 5ms after entering Receive from PowerDown/Idle
 
 /* Fan speed presets */
 enum {
@@ -56,6 +54,37 @@ enum {
 
 typedef enum { ResultOk, ResultBusy, ResultFailure } Result;
 
+/* Frame capture record, as dumped */
+typedef enum { CaptureRx, CaptureTx } CaptureDirection;
+
+typedef struct __attribute__((packed)) {
+  uint32_t time;                 // micros()
+  uint8_t direction;             // CaptureDirection
+  uint8_t mode;                  // nRF905 mode at the time
+  uint8_t state;                 // ZehnderRF state at the time
+  uint8_t length;                // Frame length as received
+  uint8_t frame[FAN_FRAMESIZE];  // Frame, zero padded
+} CaptureRecord;
+
+/* Tags for nRF905 SPI trace marks */
+enum { TraceMarkPoll = 0x01 };
+
+/* Metrics that can be published as sensors */
+typedef enum {
+  MetricTxFrames,        // Frames sent, retries included
+  MetricRxFrames,        // Valid frames received, duplicates excluded
+  MetricDuplicates,      // Retransmissions dropped
+  MetricRetries,         // Retries sent
+  MetricTimeouts,        // Transactions given up without a reply
+  MetricAirwayTimeouts,  // Frames given up without getting on air
+  MetricFailedCommands,  // Guaranteed commands not confirmed within command_timeout
+  MetricRtt,             // Median TX -> reply round trip (ms)
+  MetricAirwayWait,      // 90th percentile frame ready -> on air (ms)
+  MetricControlLatency,  // 90th percentile speed request -> confirmed (ms)
+
+  MetricNrOf  // Keep last
+} Metric;
+
 class ZehnderRF : public Component, public fan::Fan {
  public:
   ZehnderRF();
@@ -66,6 +95,17 @@ class ZehnderRF : public Component, public fan::Fan {
   void set_rf(nrf905::nRF905 *const pRf) { rf_ = pRf; }
 
   void set_update_interval(const uint32_t interval) { interval_ = interval; }
+  void set_max_update_interval(const uint32_t interval) { maxInterval_ = interval; }
+  void set_command_timeout(const uint32_t timeout) { commandTimeout_ = timeout; }
+  void set_idle_mode(const nrf905::Mode mode) { idleMode_ = mode; }
+  void set_metric_sensor(const Metric metric, sensor::Sensor *const sensor) { metricSensor_[metric] = sensor; }
+
+  void reset_metrics(void);
+
+  void set_capture_size(const uint16_t size) { captureSize_ = size; }
+  void dump_capture(void);
+  size_t captureImageSize(void) const;
+  size_t readCapture(uint8_t *const pBuffer, const size_t bufferSize);
 
   void dump_config() override;
 
@@ -83,6 +123,9 @@ class ZehnderRF : public Component, public fan::Fan {
   bool timer;
   int voltage;
 
+  uint8_t get_timer_remaining(void);
+  bool is_state_stale(void) const { return stateStale_; }
+
   // Add the new enum and method here
   enum ErrorCode {
     NO_ERROR = 0,
@@ -97,16 +140,49 @@ class ZehnderRF : public Component, public fan::Fan {
 
  protected:
   void queryDevice(void);
+  void sendSpeed(const uint8_t speed, const uint8_t timer);
+  void requestSpeed(const uint8_t speed, const uint8_t timer, const bool guaranteed);
+  void applyFanSettings(const uint8_t speed, const uint8_t voltage, const uint8_t timer);
 
+  uint32_t pollDelay(void);
+  void pollSucceeded(const bool changed);
+  void pollFailed(void);
+  void modelTimer(const uint8_t minutes);
+
+  bool configValid(void);
+  RfRoute routeTo(const uint8_t rxType, const uint8_t rxId);
   uint8_t createDeviceID(void);
   void discoveryStart(const uint8_t deviceId);
 
+  // Called when a transmission got no reply after all retries
+  typedef void (ZehnderRF::*TimeoutHandler)(void);
+
   Result startTransmit(const uint8_t *const pData, const int8_t rxRetries = -1,
-                       const std::function<void(void)> callback = NULL);
+                       const TimeoutHandler onTimeout = NULL);
+  void onDiscoveryTimeout(void);
+  void onQueryTimeout(void);
+  void onSetSpeedTimeout(void);
   void rfComplete(void);
+  void rfAbort(void);
+  void rfWaitAirwayFree(void);
   void rfHandler(void);
+  void rfTxReady(void);
+  void rfTimeout(const bool airway);
   void rfHandleReceived(const uint8_t *const pData, const uint8_t dataLength);
 
+  void dumpLatency(const char *const name, const LatencyHistogram &histogram);
+  void dumpCounters(const char *const name, const uint32_t *const pCounters, const uint8_t count);
+  void countFrame(uint32_t *const pCounters, const uint8_t command);
+  uint32_t sumCounters(const uint32_t *const pCounters, const uint8_t count);
+  void publishMetrics(void);
+  void captureFrame(const CaptureDirection direction, const uint32_t time, const uint8_t *const pData,
+                    const uint8_t dataLength);
+  void captureHeader(uint8_t *const pHeader, const uint16_t count);
+
+  bool isDuplicate(const uint8_t *const pData, const uint8_t dataLength);
+  void forgetRepliesToUs(void);
+  bool rfHandleOverheard(const RfFrame *const pFrame);
+
   typedef enum {
     StateStartup,
     StateStartDiscovery,
@@ -125,6 +201,7 @@ class ZehnderRF : public Component, public fan::Fan {
   int speed_count_{};
 
   nrf905::nRF905 *rf_;
+  nrf905::Mode idleMode_{nrf905::Receive};  // Radio mode between transactions
   uint32_t interval_;
 
   uint8_t _txFrame[FAN_FRAMESIZE];
@@ -140,16 +217,78 @@ class ZehnderRF : public Component, public fan::Fan {
   } Config;
   Config config_;
 
-  uint32_t lastFanQuery_{0};
-  std::function<void(void)> onReceiveTimeout_ = NULL;
+  // Last confirmed settings, restored at boot
+  typedef struct {
+    uint8_t speed;
+    uint8_t voltage;
+  } SavedState;
+  ESPPreferenceObject statePref_;
+  SavedState savedState_{0, 0};
+  bool stateStale_{false};  // Restored settings not yet verified by the fan
+
+  uint32_t lastFanQuery_{0};  // Last poll sent, start of pollLatency_
+  uint32_t lastFanState_{0};  // Last poll sent or state overheard, the next poll is due pollDelay() after it
+  uint32_t maxInterval_{0};
+  uint32_t pollInterval_{0};  // Grows from interval_ to maxInterval_ while nothing changes
+  bool pollFast_{false};      // Fan reported a change, poll again after FAN_POLL_FAST
+  uint8_t pollFailures_{0};   // Consecutive polls without a reply
+  bool timerRunning_{false};  // Local model of the fan timer
+  uint32_t timerEnd_{0};      // millis() at which the fan timer is expected to run out
+  TimeoutHandler onReceiveTimeout_{NULL};
 
   uint32_t msgSendTime_{0};
+  uint32_t rxTime_{0};  // millis() the frame being handled was received
+  uint32_t replyTimeout_{FAN_REPLY_TIMEOUT};
+  uint8_t txAttempt_{0};  // Retries done for the current frame
+  uint32_t transactionStartTime_{0};  // millis() the transaction started, for FAN_TRANSACTION_TIMEOUT
+  uint32_t txStartTime_{0};  // millis() the frame was handed to the radio
   uint32_t airwayFreeWaitTime_{0};
+  uint32_t airwayCheckTime_{0};  // Next carrier sense
+  uint8_t backoffExponent_{0};
   int8_t retries_{-1};
 
-  uint8_t newSpeed{0};
-  uint8_t newTimer{0};
-  bool newSetting{false};
+  typedef enum {
+    CommandQuery,     // Poll fan settings
+    CommandSetSpeed,  // Set speed, with optional timer
+
+    CommandNrOf  // Keep last
+  } CommandType;
+
+  typedef enum {
+    PriorityPoll,  // Periodic polls
+    PriorityUser,  // User commands; go first and preempt a pending poll
+  } CommandPriority;
+
+  typedef struct {
+    CommandType type;
+    CommandPriority priority;
+    uint8_t speed;
+    uint8_t timer;
+    uint32_t queueTime;  // millis() of the request
+    bool guaranteed;     // Keep retrying until commandTimeout_, then fail visibly
+  } Command;
+
+  void queueCommand(const Command &command);
+  void queueCommand(const CommandType type);
+  bool userCommandPending(void);
+  void runCommandQueue(void);
+  void expireCommands(void);
+  void retryActiveCommand(void);
+  void commandFailed(const Command &command);
+
+  // Sorted on priority, FIFO within a priority. A newer command replaces a queued one of the same type, so there is
+  // never more than one per type.
+  Command commandQueue_[CommandNrOf];
+  uint8_t commandCount_{0};
+  Command activeCommand_;  // Command of the transaction in flight
+  bool activeCommandValid_{false};
+  uint32_t commandTimeout_{30000};
+
+  // Last settings reported by the fan
+  bool confirmed_{false};
+  uint8_t confirmedSpeed_{0};
+  uint8_t confirmedVoltage_{0};
+  uint8_t confirmedTimer_{0};
 
   typedef enum {
     RfStateIdle,            // Idle state
@@ -160,7 +299,81 @@ class ZehnderRF : public Component, public fan::Fan {
   RfState rfState_{RfStateIdle};
 
   ErrorCode error_code_{NO_ERROR}; // Declare this to hold the error code
+
+  // Round trip time estimation per command class (RFC 6298 style)
+  typedef enum {
+    RttQuery,     // Query device
+    RttSetSpeed,  // Set speed/timer/voltage
+    RttJoin,      // Join request and link acknowledge
+    RttNrOf,      // Keep last; commands without a class use the fixed FAN_REPLY_TIMEOUT
+  } RttClass;
+
+  typedef struct {
+    uint32_t srtt;    // Smoothed round trip time
+    uint32_t rttvar;  // Round trip time variation
+    bool valid;
+  } RttEstimate;
+
+  RttClass rttClass(const uint8_t command);
+  void rttSample(const uint32_t rtt);
+  uint32_t rttTimeout(void);
+
+  RttEstimate rtt_[RttNrOf]{};
+
+  // Latency statistics
+  uint32_t pairingStartTime_{0};
+  uint32_t setSpeedTime_{0};
+  LatencyHistogram pairingLatency_;   // Discovery start -> pairing saved
+  LatencyHistogram setSpeedLatency_;  // setSpeed() -> fan settings confirmed
+  LatencyHistogram pollLatency_;      // queryDevice() -> fan settings received
+  LatencyHistogram airwayLatency_;    // Frame ready -> on air
+
+  // Recently received frames
+  typedef struct {
+    uint8_t frame[FAN_FRAMESIZE];
+    uint32_t time;
+  } RecentFrame;
+  RecentFrame recentFrames_[FAN_DUPLICATE_CACHE]{};
+  uint8_t recentFrameIndex_{0};
+  uint32_t duplicateFrames_{0};
+  uint32_t overheardFrames_{0};  // Frames between other remotes and the main unit used for state
+  uint32_t malformedFrames_{0};  // Too short or missing parameters for their command
+
+  // Link metrics
+  uint32_t txFrames_[FAN_COMMAND_SLOTS]{};       // Frames sent per command, every attempt
+  uint32_t rxFrames_[FAN_COMMAND_SLOTS]{};       // Valid frames received per command, duplicates excluded
+  uint32_t retryCounts_[FAN_TX_RETRIES + 2]{};  // Transactions by retries used; the last slot gave up
+  uint32_t timeouts_[StateNrOf]{};              // Transactions given up per protocol state
+  uint32_t airwayTimeouts_{0};                  // Frames given up because the airway stayed busy
+  uint32_t failedCommands_{0};                  // Guaranteed commands not confirmed in time
+  LatencyHistogram rttLatency_;                 // Frame on air -> reply received, retries included
+  sensor::Sensor *metricSensor_[MetricNrOf]{};
+
+  // Frame capture ring buffer; allocated once at setup, recording is a copy per frame
+  CaptureRecord *capture_{NULL};
+  uint16_t captureSize_{0};   // Records, 0 disables the capture
+  uint16_t captureCount_{0};  // Records in use
+  uint16_t captureNext_{0};   // Next record to write
+#ifdef USE_WEBSERVER
+  std::mutex captureLock_;  // The download is served from the web server task
+#endif
+};
+
+#ifdef USE_WEBSERVER
+/* Serves the frame capture as a binary download, same format as dump_capture() */
+class CaptureHandler : public AsyncWebHandler {
+ public:
+  CaptureHandler(ZehnderRF *const pFan) : fan_(pFan) {}
+
+  bool canHandle(AsyncWebServerRequest *request) const override {
+    return (request->method() == HTTP_GET) && (request->url() == FAN_CAPTURE_URL);
+  }
+  void handleRequest(AsyncWebServerRequest *request) override;
+
+ protected:
+  ZehnderRF *fan_;
 };
+#endif
 
 }  // namespace zehnder
 }  // namespace esphome
@@ -0,0 +1,132 @@
+// Link latency under impairments, on virtual time: pairing, set speed -> confirmed and poll round trip.
+//   bench_link          full run
+//   bench_link --quick  few samples, as run by ctest; fails when the unimpaired link misses anything
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "simulation.h"
+
+using namespace esphome;
+using namespace sim;
+
+typedef struct {
+  const char *name;
+  double loss;             // Per frame and receiver
+  uint32_t replyMin;       // Main unit reply delay (in us)
+  uint32_t replyMax;
+  uint64_t busyPeriod;     // Carrier busy every period for duration (in ns)
+  uint64_t busyDuration;
+} Scenario;
+
+static const Scenario SCENARIOS[] = {
+    {"clean", 0.0, 15000, 30000, 0, 0},
+    {"loss 10%", 0.1, 15000, 30000, 0, 0},
+    {"loss 30%", 0.3, 15000, 30000, 0, 0},
+    {"loss 70%", 0.7, 15000, 30000, 0, 0},
+    {"slow unit", 0.0, 100000, 300000, 0, 0},
+    {"busy 20/100ms", 0.0, 15000, 30000, 100000000, 20000000},
+};
+
+class Samples {
+ public:
+  void add(const uint32_t value) { this->values_.push_back(value); }
+  void fail(void) { ++this->failures_; }
+  uint32_t getFailures(void) const { return this->failures_; }
+
+  uint32_t percentile(const uint8_t percentile) {
+    if (this->values_.empty()) {
+      return 0;
+    }
+    std::sort(this->values_.begin(), this->values_.end());
+    return this->values_[((this->values_.size() - 1) * percentile) / 100];
+  }
+
+  void print(const char *const scenario, const char *const name) {
+    printf("%-14s %-10s n=%3zu p50=%5u p90=%5u p99=%5u max=%5u ms  failed=%u\n", scenario, name,
+           this->values_.size(), this->percentile(50), this->percentile(90), this->percentile(99),
+           this->percentile(100), this->failures_);
+  }
+
+ protected:
+  std::vector<uint32_t> values_;
+  uint32_t failures_{0};
+};
+
+static void impair(FanSimulation &sim, const Scenario &scenario) {
+  sim.air.setLoss(scenario.loss);
+  sim.mainUnit.setReplyDelay(scenario.replyMin, scenario.replyMax);
+  if (scenario.busyPeriod > 0) {
+    sim.air.setPeriodicBusy(scenario.busyPeriod, scenario.busyDuration);
+  }
+}
+
+// One sample of a component histogram: reset, run until it has a value, take it
+static void measure(FanSimulation &sim, zehnder::LatencyHistogram &histogram, const std::function<void()> &start,
+                    const uint32_t timeoutMs, Samples &samples) {
+  histogram.reset();
+  start();
+  if (sim.runUntil([&]() { return histogram.getCount() > 0; }, timeoutMs)) {
+    samples.add(histogram.getMax());
+  } else {
+    samples.fail();
+  }
+}
+
+static uint32_t run(const Scenario &scenario, const uint32_t pairings, const uint32_t commands) {
+  Samples pairing;
+  Samples setSpeed;
+  Samples poll;
+
+  for (uint32_t i = 0; i < pairings; ++i) {
+    SimulationOptions options;
+
+    options.paired = false;
+    options.seed = i + 1;
+    FanSimulation sim(options);
+
+    impair(sim, scenario);
+    measure(sim, sim.fan.pairingLatency_, [&]() { sim.boot(); }, 120000, pairing);
+  }
+
+  SimulationOptions options;
+
+  options.interval = 2000;
+  options.maxInterval = 2000;
+  options.seed = 1000;
+  FanSimulation sim(options);
+
+  impair(sim, scenario);
+  sim.boot();
+  for (uint32_t i = 0; i < commands; ++i) {
+    measure(sim, sim.fan.pollLatency_, []() {}, 60000, poll);
+    measure(sim, sim.fan.setSpeedLatency_, [&]() { sim.fan.setSpeed(1 + (i % 4)); }, 60000, setSpeed);
+  }
+
+  pairing.print(scenario.name, "pairing");
+  setSpeed.print(scenario.name, "set speed");
+  poll.print(scenario.name, "poll");
+
+  return pairing.getFailures() + setSpeed.getFailures() + poll.getFailures();
+}
+
+int main(int argc, char **argv) {
+  const bool quick = (argc > 1) && (strcmp(argv[1], "--quick") == 0);
+  const uint32_t pairings = quick ? 3 : 20;
+  const uint32_t commands = quick ? 10 : 100;
+  uint32_t cleanFailures = 0;
+
+  for (const Scenario &scenario : SCENARIOS) {
+    const uint32_t failures = run(scenario, pairings, commands);
+
+    if (&scenario == &SCENARIOS[0]) {
+      cleanFailures = failures;
+    }
+  }
+
+  return (cleanFailures == 0) ? 0 : 1;
+}
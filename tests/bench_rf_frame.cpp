@@ -0,0 +1,79 @@
+// Encode and decode throughput of the RfFrame codec; frames per second and ns per frame.
+//
+//   bench_rf_frame [--quick]
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "esphome/components/zehnder/rf_frame.h"
+
+using namespace esphome::zehnder;
+
+#define BENCH_FRAMES 20000000       // Frames per measurement
+#define BENCH_FRAMES_QUICK 1000000  // Frames per measurement with --quick
+
+static const RfRoute ROUTE = {FAN_TYPE_MAIN_UNIT, 0x42, FAN_TYPE_REMOTE_CONTROL, 0x5A};
+
+// Makes the buffer contents observable, so each iteration really builds or reads its frame
+static inline void clobber(const void *const pBuffer) { asm volatile("" : : "g"(pBuffer) : "memory"); }
+
+template<typename F> static void measure(const char *const name, const uint32_t frames, F run) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint32_t check = run(frames);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-24s %8.2f ns/frame %12.0f frames/s  (check %08X)\n", name, (seconds * 1e9) / frames, frames / seconds,
+         check);
+}
+
+int main(int argc, char **argv) {
+  const uint32_t frames = ((argc > 1) && (strcmp(argv[1], "--quick") == 0)) ? BENCH_FRAMES_QUICK : BENCH_FRAMES;
+  uint8_t buffer[FAN_FRAMESIZE];
+  uint8_t received[4][FAN_FRAMESIZE];
+
+  measure("encode query", frames, [&](const uint32_t count) {
+    uint32_t check = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+      rfBuildQueryDevice(buffer, ROUTE);
+      clobber(buffer);
+      check += buffer[5];
+    }
+    return check;
+  });
+
+  measure("encode set timer", frames, [&](const uint32_t count) {
+    uint32_t check = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+      rfBuildSetTimer(buffer, ROUTE, i & 0x03, i & 0xFF);
+      clobber(buffer);
+      check += buffer[8];
+    }
+    return check;
+  });
+
+  // Mix of valid and malformed frames, as received
+  rfBuildSetTimer(received[0], ROUTE, 2, 10);
+  rfBuildJoinRequest(received[1], ROUTE, 0x1A2B3C4D);
+  rfBuildSetSpeed(received[2], ROUTE, 3);
+  received[2][6] = 0x00;  // Parameter missing
+  rfBuildQueryDevice(received[3], ROUTE);
+  received[3][6] = 0x20;  // Parameter count out of range
+
+  measure("decode mixed", frames, [&](const uint32_t count) {
+    uint32_t check = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+      const RfFrame *const pFrame = rfFrameDecode(received[i & 0x03], FAN_FRAMESIZE - ((i >> 8) & 0x01));
+
+      clobber(received);
+      check += (pFrame != NULL) ? pFrame->command : 1;
+    }
+    return check;
+  });
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace fan {
+
+class FanTraits {
+ public:
+  FanTraits() = default;
+  FanTraits(const bool oscillation, const bool speed, const bool direction, const int speed_count)
+      : oscillation_(oscillation), speed_(speed), direction_(direction), speed_count_(speed_count) {}
+
+  bool supports_speed() const { return this->speed_; }
+  int supported_speed_count() const { return this->speed_count_; }
+
+ protected:
+  bool oscillation_{false};
+  bool speed_{false};
+  bool direction_{false};
+  int speed_count_{0};
+};
+
+class Fan;
+
+class FanCall {
+ public:
+  explicit FanCall(Fan &parent) : parent_(parent) {}
+
+  FanCall &set_state(const bool state) {
+    this->state_ = state;
+    return *this;
+  }
+  FanCall &set_speed(const int speed) {
+    this->speed_ = speed;
+    return *this;
+  }
+  optional<bool> get_state() const { return this->state_; }
+  optional<int> get_speed() const { return this->speed_; }
+
+  void perform();
+
+ protected:
+  Fan &parent_;
+  optional<bool> state_;
+  optional<int> speed_;
+};
+
+class Fan {
+ public:
+  virtual ~Fan() = default;
+
+  FanCall make_call() { return FanCall(*this); }
+  void publish_state() { ++this->publishes_; }
+
+  void set_name(const std::string &name) { this->name_ = name; }
+  const std::string &get_name() const { return this->name_; }
+  uint32_t get_publishes() const { return this->publishes_; }
+
+  virtual FanTraits get_traits() = 0;
+
+  bool state{false};
+  int speed{0};
+
+ protected:
+  friend FanCall;
+
+  virtual void control(const FanCall &call) = 0;
+
+  std::string name_;
+  uint32_t publishes_{0};
+};
+
+inline void FanCall::perform() { this->parent_.control(*this); }
+
+}  // namespace fan
+}  // namespace esphome
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+namespace esphome {
+namespace sensor {
+
+class Sensor {
+ public:
+  explicit Sensor(const std::string &name = "") : name_(name) {}
+
+  void publish_state(const float state) {
+    this->state = state;
+    this->has_state_ = true;
+    ++this->publishes_;
+  }
+
+  bool has_state() const { return this->has_state_; }
+  const std::string &get_name() const { return this->name_; }
+  uint32_t get_publishes() const { return this->publishes_; }
+
+  float state{0.0f};
+
+ protected:
+  std::string name_;
+  bool has_state_{false};
+  uint32_t publishes_{0};
+};
+
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esphome/core/hal.h"
+#include "host.h"
+
+namespace esphome {
+namespace spi {
+
+enum SPIBitOrder { BIT_ORDER_LSB_FIRST, BIT_ORDER_MSB_FIRST };
+enum SPIClockPolarity { CLOCK_POLARITY_LOW, CLOCK_POLARITY_HIGH };
+enum SPIClockPhase { CLOCK_PHASE_LEADING, CLOCK_PHASE_TRAILING };
+enum SPIDataRate : uint32_t {
+  DATA_RATE_1KHZ = 1000,
+  DATA_RATE_200KHZ = 200000,
+  DATA_RATE_1MHZ = 1000000,
+  DATA_RATE_2MHZ = 2000000,
+  DATA_RATE_4MHZ = 4000000,
+  DATA_RATE_8MHZ = 8000000,
+  DATA_RATE_10MHZ = 10000000,
+};
+
+// Host build: the bus is a device model; chip select frames a transaction
+class SPIComponent {
+ public:
+  virtual ~SPIComponent() = default;
+  virtual void begin_transaction() = 0;
+  virtual uint8_t transfer(uint8_t data) = 0;
+  virtual void end_transaction() = 0;
+};
+
+// Every byte takes its time on the virtual clock, like a blocking transfer on the device
+template<SPIBitOrder BIT_ORDER, SPIClockPolarity CLOCK_POLARITY, SPIClockPhase CLOCK_PHASE, SPIDataRate DATA_RATE>
+class SPIDevice {
+ public:
+  void set_spi_parent(SPIComponent *const parent) { this->parent_ = parent; }
+  void set_cs_pin(GPIOPin *const cs) { this->cs_ = cs; }
+  void set_data_rate(const uint32_t data_rate) { this->data_rate_ = data_rate; }
+
+  void spi_setup() {
+    if (this->cs_ != nullptr) {
+      this->cs_->setup();
+      this->cs_->digital_write(true);
+    }
+  }
+
+  void enable() {
+    if (this->cs_ != nullptr) {
+      this->cs_->digital_write(false);
+    }
+    this->parent_->begin_transaction();
+  }
+
+  void disable() {
+    this->parent_->end_transaction();
+    if (this->cs_ != nullptr) {
+      this->cs_->digital_write(true);
+    }
+  }
+
+  uint8_t transfer_byte(const uint8_t data) {
+    host::advance_ns(8000000000ULL / this->data_rate_);
+    return this->parent_->transfer(data);
+  }
+
+  void transfer_array(uint8_t *const data, const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+      data[i] = this->transfer_byte(data[i]);
+    }
+  }
+
+  uint8_t read_byte() { return this->transfer_byte(0x00); }
+
+  void read_array(uint8_t *const data, const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+      data[i] = this->transfer_byte(0x00);
+    }
+  }
+
+  void write_byte(const uint8_t data) { (void) this->transfer_byte(data); }
+
+  void write_array(const uint8_t *const data, const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+      (void) this->transfer_byte(data[i]);
+    }
+  }
+
+ protected:
+  SPIComponent *parent_{nullptr};
+  GPIOPin *cs_{nullptr};
+  uint32_t data_rate_{DATA_RATE};
+};
+
+}  // namespace spi
+}  // namespace esphome
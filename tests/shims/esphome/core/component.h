@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
+
+namespace esphome {
+
+namespace setup_priority {
+extern const float BUS;
+extern const float IO;
+extern const float HARDWARE;
+extern const float DATA;
+extern const float PROCESSOR;
+extern const float LATE;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return setup_priority::DATA; }
+
+  bool is_failed() const { return this->failed_; }
+  bool status_has_warning() const { return this->warning_; }
+
+ protected:
+  // Run by host::run_scheduler() from the test's main loop
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+  bool cancel_interval(const std::string &name);
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+
+  void status_set_warning() { this->warning_ = true; }
+  void status_clear_warning() { this->warning_ = false; }
+  void mark_failed() { this->failed_ = true; }
+
+  bool failed_{false};
+  bool warning_{false};
+};
+
+}  // namespace esphome
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "esphome/core/optional.h"
+
+namespace esphome {
+
+uint32_t random_uint32();
+uint32_t fnv1_hash(const std::string &str);
+
+// Keeps the main loop running without its idle delay while started
+class HighFrequencyLoopRequester {
+ public:
+  ~HighFrequencyLoopRequester() { this->stop(); }  // Host build: components are torn down between tests
+
+  void start();
+  void stop();
+  static bool is_high_frequency();
+
+ protected:
+  bool started_{false};
+  static uint8_t num_requests;
+};
+
+}  // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+namespace esphome {
+namespace host {
+
+// Runtime level, HOST_LOG_LEVEL=<0-7> in the environment; arguments are only evaluated when enabled
+extern int log_level;
+void log(int level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+}  // namespace host
+}  // namespace esphome
+
+#define HOST_LOG_(level, tag, ...) \
+  do { \
+    if (::esphome::host::log_level >= (level)) { \
+      ::esphome::host::log((level), (tag), __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define ESP_LOGE(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+#define ESP_LOGVV(tag, ...) HOST_LOG_(ESPHOME_LOG_LEVEL_VERY_VERBOSE, tag, __VA_ARGS__)
+
+#define LOG_PIN(prefix, pin) \
+  if ((pin) != nullptr) { \
+    ESP_LOGCONFIG(TAG, prefix " %s", (pin)->dump_summary().c_str()); \
+  }
+
+#define LOG_SENSOR(prefix, type, obj) \
+  if ((obj) != nullptr) { \
+    ESP_LOGCONFIG(TAG, "%s%s '%s'", prefix, type, (obj)->get_name().c_str()); \
+  }
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace esphome {
+
+struct nullopt_t {};
+constexpr nullopt_t nullopt{};
+
+// Just enough of esphome::optional for the components
+template<typename T> class optional {
+ public:
+  optional() = default;
+  optional(nullopt_t) {}
+  optional(const T &value) : value_(value), has_value_(true) {}
+
+  bool has_value() const { return this->has_value_; }
+  explicit operator bool() const { return this->has_value_; }
+  const T &operator*() const { return this->value_; }
+  const T &value() const { return this->value_; }
+  T value_or(const T &other) const { return this->has_value_ ? this->value_ : other; }
+
+ protected:
+  T value_{};
+  bool has_value_{false};
+};
+
+}  // namespace esphome
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace esphome {
+
+// Host build: kept in RAM for the lifetime of the process, so a test can "reboot" by building new components
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() = default;
+  explicit ESPPreferenceObject(const uint32_t key) : key_(key), valid_(true) {}
+
+  template<typename T> bool save(const T *src) { return this->save_(reinterpret_cast<const uint8_t *>(src), sizeof(T)); }
+  template<typename T> bool load(T *dest) { return this->load_(reinterpret_cast<uint8_t *>(dest), sizeof(T)); }
+
+ protected:
+  bool save_(const uint8_t *data, size_t length);
+  bool load_(uint8_t *data, size_t length);
+
+  uint32_t key_{0};
+  bool valid_{false};
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(const uint32_t type, const bool in_flash) {
+    (void) in_flash;
+    return ESPPreferenceObject(type);
+  }
+};
+
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome
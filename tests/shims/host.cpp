@@ -0,0 +1,212 @@
+#include "host.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+
+namespace esphome {
+
+namespace setup_priority {
+const float BUS = 1000.0f;
+const float IO = 900.0f;
+const float HARDWARE = 800.0f;
+const float DATA = 600.0f;
+const float PROCESSOR = 400.0f;
+const float LATE = -100.0f;
+}  // namespace setup_priority
+
+namespace host {
+
+static std::atomic<uint64_t> clock_ns{0};
+
+uint64_t now_ns() { return clock_ns.load(); }
+
+void advance_ns(const uint64_t ns) { clock_ns.fetch_add(ns); }
+
+void advance_to_ns(const uint64_t ns) {
+  uint64_t current = clock_ns.load();
+
+  while ((current < ns) && !clock_ns.compare_exchange_weak(current, ns)) {
+  }
+}
+
+void set_time_ns(const uint64_t ns) { clock_ns.store(ns); }
+
+static uint32_t random_state = 1;
+
+void seed_random(const uint32_t seed) { random_state = (seed != 0) ? seed : 1; }
+
+static int initial_log_level() {
+  const char *const level = getenv("HOST_LOG_LEVEL");
+
+  return (level != nullptr) ? atoi(level) : ESPHOME_LOG_LEVEL_WARN;
+}
+
+int log_level = initial_log_level();
+
+void log(const int level, const char *const tag, const char *const format, ...) {
+  static const char LETTERS[] = "-EWICDVV";
+  va_list args;
+
+  fprintf(stderr, "%10.3f [%c][%s] ", now_ns() / 1e6, LETTERS[level & 0x07], tag);
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+struct ScheduledItem {
+  Component *component;
+  std::string name;
+  uint32_t interval;
+  uint64_t next;  // ns
+  bool repeat;
+  std::function<void()> callback;
+};
+
+static std::vector<ScheduledItem> scheduled;
+
+static void schedule(Component *const component, const std::string &name, const uint32_t interval,
+                     std::function<void()> &&f, const bool repeat) {
+  for (ScheduledItem &item : scheduled) {
+    if ((item.component == component) && (item.name == name)) {
+      item = {component, name, interval, now_ns() + (interval * 1000000ULL), repeat, std::move(f)};
+      return;
+    }
+  }
+  scheduled.push_back({component, name, interval, now_ns() + (interval * 1000000ULL), repeat, std::move(f)});
+}
+
+void run_scheduler() {
+  for (size_t i = 0; i < scheduled.size();) {
+    ScheduledItem &item = scheduled[i];
+
+    if (now_ns() < item.next) {
+      ++i;
+      continue;
+    }
+    item.callback();
+    if (scheduled[i].repeat) {
+      scheduled[i].next += scheduled[i].interval * 1000000ULL;
+      ++i;
+    } else {
+      scheduled.erase(scheduled.begin() + i);
+    }
+  }
+}
+
+void clear_scheduler() { scheduled.clear(); }
+
+static std::map<uint32_t, std::vector<uint8_t>> preferences;
+static uint32_t saves = 0;
+
+void clear_preferences() {
+  preferences.clear();
+  saves = 0;
+}
+
+uint32_t preference_saves() { return saves; }
+
+}  // namespace host
+
+uint32_t millis() { return (uint32_t) (host::now_ns() / 1000000); }
+uint32_t micros() { return (uint32_t) (host::now_ns() / 1000); }
+void delay(const uint32_t ms) { host::advance_ns(ms * 1000000ULL); }
+void delayMicroseconds(const uint32_t us) { host::advance_ns(us * 1000ULL); }
+
+uint32_t random_uint32() {
+  // xorshift32, reproducible per seed
+  uint32_t x = host::random_state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  host::random_state = x;
+  return x;
+}
+
+uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+
+  for (const char c : str) {
+    hash *= 16777619UL;
+    hash ^= (uint8_t) c;
+  }
+  return hash;
+}
+
+uint8_t HighFrequencyLoopRequester::num_requests = 0;
+
+void HighFrequencyLoopRequester::start() {
+  if (!this->started_) {
+    this->started_ = true;
+    ++num_requests;
+  }
+}
+
+void HighFrequencyLoopRequester::stop() {
+  if (this->started_) {
+    this->started_ = false;
+    --num_requests;
+  }
+}
+
+bool HighFrequencyLoopRequester::is_high_frequency() { return num_requests > 0; }
+
+void Component::set_interval(const std::string &name, const uint32_t interval, std::function<void()> &&f) {
+  host::schedule(this, name, interval, std::move(f), true);
+}
+
+bool Component::cancel_interval(const std::string &name) {
+  for (size_t i = 0; i < host::scheduled.size(); ++i) {
+    if ((host::scheduled[i].component == this) && (host::scheduled[i].name == name)) {
+      host::scheduled.erase(host::scheduled.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Component::set_timeout(const std::string &name, const uint32_t timeout, std::function<void()> &&f) {
+  host::schedule(this, name, timeout, std::move(f), false);
+}
+
+static ESPPreferences preferences_instance;
+ESPPreferences *global_preferences = &preferences_instance;
+
+bool ESPPreferenceObject::save_(const uint8_t *const data, const size_t length) {
+  if (!this->valid_) {
+    return false;
+  }
+  std::vector<uint8_t> &stored = host::preferences[this->key_];
+
+  stored.assign(data, data + length);
+  ++host::saves;
+  return true;
+}
+
+bool ESPPreferenceObject::load_(uint8_t *const data, const size_t length) {
+  if (!this->valid_) {
+    return false;
+  }
+  const auto it = host::preferences.find(this->key_);
+
+  if ((it == host::preferences.end()) || (it->second.size() != length)) {
+    return false;
+  }
+  memcpy(data, it->second.data(), length);
+  return true;
+}
+
+}  // namespace esphome
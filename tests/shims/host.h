@@ -0,0 +1,30 @@
+#pragma once
+
+// Host build controls the ESPHome shims don't have: the virtual clock, the scheduler and the stores behind them
+
+#include <stdint.h>
+
+namespace esphome {
+namespace host {
+
+// Virtual clock; only moves when advanced. millis()/micros() wrap like on the device.
+uint64_t now_ns();
+void advance_ns(uint64_t ns);
+void advance_to_ns(uint64_t ns);  // Never moves back
+void set_time_ns(uint64_t ns);
+
+inline uint64_t now_us() { return now_ns() / 1000; }
+
+// random_uint32() sequence
+void seed_random(uint32_t seed);
+
+// set_interval()/set_timeout() callbacks that are due
+void run_scheduler();
+void clear_scheduler();
+
+// Preferences survive a component rebuild, clear them for a factory fresh device
+void clear_preferences();
+uint32_t preference_saves();
+
+}  // namespace host
+}  // namespace esphome
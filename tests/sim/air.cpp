@@ -0,0 +1,232 @@
+#include "air.h"
+
+namespace sim {
+
+void Air::attach(AirNode *const node) {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+
+  if (this->nodeCount_ < AIR_MAX_NODES) {
+    this->nodes_[this->nodeCount_++] = node;
+  }
+}
+
+void Air::detach(AirNode *const node) {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+
+  for (uint8_t i = 0; i < this->nodeCount_; ++i) {
+    if (this->nodes_[i] == node) {
+      this->nodes_[i] = this->nodes_[--this->nodeCount_];
+      return;
+    }
+  }
+}
+
+uint32_t Air::transmit(const Transmission &tx) {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+  uint8_t slot = AIR_MAX_FRAMES;
+
+  for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+    if (this->used_[i] == false) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == AIR_MAX_FRAMES) {
+    return 0;  // Channel saturated, frame never makes it
+  }
+
+  Transmission *const pFrame = &this->onAir_[slot];
+
+  *pFrame = tx;
+  pFrame->id = this->nextId_++;
+  pFrame->collided = false;
+  pFrame->cut = false;
+  this->used_[slot] = true;
+  ++this->frameCount_;
+
+  for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+    Transmission *const pOther = &this->onAir_[i];
+
+    if ((i != slot) && (this->used_[i] == true) && (pOther->channel == tx.channel) && (pOther->band == tx.band) &&
+        (pOther->start < tx.end) && (tx.start < pOther->end)) {
+      pOther->collided = true;
+      pFrame->collided = true;
+      ++this->collisions_;
+    }
+  }
+
+  for (uint8_t i = 0; i < this->nodeCount_; ++i) {
+    if (this->nodes_[i] != tx.sender) {
+      this->nodes_[i]->onAirStart(*pFrame);
+    }
+  }
+
+  return pFrame->id;
+}
+
+void Air::cut(const uint32_t id, const uint64_t now) {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+
+  for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+    if ((this->used_[i] == true) && (this->onAir_[i].id == id) && (now < this->onAir_[i].end)) {
+      this->onAir_[i].end = now;
+      this->onAir_[i].cut = true;
+    }
+  }
+}
+
+void Air::update(const uint64_t now) {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+
+  for (;;) {
+    uint64_t first = AIR_NEVER;
+    int8_t frame = -1;
+    AirNode *pNode = nullptr;
+
+    for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+      if ((this->used_[i] == true) && (this->onAir_[i].end < first)) {
+        first = this->onAir_[i].end;
+        frame = i;
+      }
+    }
+    for (uint8_t i = 0; i < this->nodeCount_; ++i) {
+      const uint64_t event = this->nodes_[i]->nextEvent();
+
+      if (event < first) {
+        first = event;
+        frame = -1;
+        pNode = this->nodes_[i];
+      }
+    }
+    if (first > now) {
+      return;
+    }
+
+    if (pNode != nullptr) {
+      pNode->update(first);
+      continue;
+    }
+
+    // Copy out, the slot is free for the frames the nodes start in response
+    const Transmission tx = this->onAir_[frame];
+    const bool busy = this->busyDuring(tx.start, tx.end);
+
+    this->used_[frame] = false;
+    for (uint8_t i = 0; i < this->nodeCount_; ++i) {
+      bool corrupted = false;
+
+      if (this->nodes_[i] != tx.sender) {
+        corrupted = tx.collided || tx.cut || busy || this->lose();
+        if (corrupted == true) {
+          ++this->lost_;
+        }
+      }
+      this->nodes_[i]->onAirEnd(tx, corrupted);
+    }
+  }
+}
+
+uint64_t Air::nextEvent() const {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+  uint64_t first = AIR_NEVER;
+
+  for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+    if ((this->used_[i] == true) && (this->onAir_[i].end < first)) {
+      first = this->onAir_[i].end;
+    }
+  }
+  for (uint8_t i = 0; i < this->nodeCount_; ++i) {
+    const uint64_t event = this->nodes_[i]->nextEvent();
+
+    if (event < first) {
+      first = event;
+    }
+  }
+
+  return first;
+}
+
+bool Air::carrier(const uint64_t now, const uint16_t channel, const bool band, const AirNode *const self) const {
+  std::lock_guard<std::recursive_mutex> lock(this->mutex_);
+
+  if (this->busyAt(now) == true) {
+    return true;
+  }
+  for (uint8_t i = 0; i < AIR_MAX_FRAMES; ++i) {
+    const Transmission *const pFrame = &this->onAir_[i];
+
+    if ((this->used_[i] == true) && (pFrame->sender != self) && (pFrame->channel == channel) &&
+        (pFrame->band == band) && (pFrame->start <= now) && (now < pFrame->end)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Air::setPeriodicBusy(const uint64_t period, const uint64_t duration, const uint64_t offset) {
+  this->busyPeriod_ = period;
+  this->busyDuration_ = duration;
+  this->busyOffset_ = offset;
+}
+
+void Air::addBusy(const uint64_t start, const uint64_t end) {
+  if (this->busyCount_ < AIR_MAX_BUSY_WINDOWS) {
+    this->busyStart_[this->busyCount_] = start;
+    this->busyEnd_[this->busyCount_] = end;
+    ++this->busyCount_;
+  }
+}
+
+void Air::clearBusy(void) {
+  this->busyPeriod_ = 0;
+  this->busyCount_ = 0;
+}
+
+bool Air::busyAt(const uint64_t time) const {
+  if ((this->busyPeriod_ > 0) && (time >= this->busyOffset_) &&
+      (((time - this->busyOffset_) % this->busyPeriod_) < this->busyDuration_)) {
+    return true;
+  }
+  for (uint8_t i = 0; i < this->busyCount_; ++i) {
+    if ((this->busyStart_[i] <= time) && (time < this->busyEnd_[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Air::busyDuring(const uint64_t start, const uint64_t end) const {
+  if (this->busyPeriod_ > 0) {
+    // Busy at either end, or a window starts in between
+    const uint64_t phase = (start >= this->busyOffset_) ? ((start - this->busyOffset_) % this->busyPeriod_) : 0;
+
+    if ((this->busyAt(start) == true) || (this->busyAt(end - 1) == true) ||
+        ((end - start) >= (this->busyPeriod_ - phase))) {
+      return true;
+    }
+  }
+  for (uint8_t i = 0; i < this->busyCount_; ++i) {
+    if ((this->busyStart_[i] < end) && (start < this->busyEnd_[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool Air::lose(void) {
+  if (this->loss_ <= 0.0) {
+    return false;
+  }
+
+  // xorshift32, independent of the sequence the components draw from
+  this->random_ ^= this->random_ << 13;
+  this->random_ ^= this->random_ >> 17;
+  this->random_ ^= this->random_ << 5;
+
+  return (this->random_ / 4294967296.0) < this->loss_;
+}
+
+}  // namespace sim
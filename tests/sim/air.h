@@ -0,0 +1,111 @@
+#pragma once
+
+// Shared 868MHz channel for the simulated radios: frames with air time, carrier, collisions and injected impairments
+
+#include <stdint.h>
+
+#include <mutex>
+
+namespace sim {
+
+#define AIR_BIT_TIME 20000      // 50kbps (in ns)
+#define AIR_MAX_FRAMES 16       // Frames on air at the same time
+#define AIR_MAX_NODES 8         // Radios on the channel
+#define AIR_MAX_BUSY_WINDOWS 8  // One-shot carrier busy windows
+#define AIR_NEVER UINT64_MAX
+
+class AirNode;
+
+struct Transmission {
+  uint32_t id;
+  uint64_t start;  // ns
+  uint64_t end;    // ns
+  uint16_t channel;
+  bool band;
+  uint8_t address[4];
+  uint8_t addressWidth;
+  uint8_t payload[32];
+  uint8_t length;
+  const AirNode *sender;
+  bool collided;  // Overlapped another frame on the channel
+  bool cut;       // Sender left TX before the end; ends at the cut, corrupted for every receiver
+};
+
+// Preamble, address, payload and CRC
+inline uint64_t frameAirTime(const uint8_t addressWidth, const uint8_t length, const uint8_t crcBits) {
+  return (10 + (8 * (addressWidth + length)) + crcBits) * (uint64_t) AIR_BIT_TIME;
+}
+
+class AirNode {
+ public:
+  virtual ~AirNode() = default;
+
+  virtual void onAirStart(const Transmission &tx) {}
+  // Every node sees the end of every frame, its own included; corrupted is per receiver
+  virtual void onAirEnd(const Transmission &tx, const bool corrupted) {}
+
+  // Internal events of the node (in ns), AIR_NEVER for none
+  virtual uint64_t nextEvent() const { return AIR_NEVER; }
+  virtual void update(const uint64_t now) {}
+};
+
+class Air {
+ public:
+  void attach(AirNode *const node);
+  void detach(AirNode *const node);
+
+  // Frame goes on air at tx.start, which is now or later; returns its id
+  uint32_t transmit(const Transmission &tx);
+
+  // Sender stops frame id at now
+  void cut(const uint32_t id, const uint64_t now);
+
+  // Ends frames and runs node events up to now, in time order
+  void update(const uint64_t now);
+  uint64_t nextEvent() const;
+
+  bool carrier(const uint64_t now, const uint16_t channel, const bool band, const AirNode *const self) const;
+
+  // Impairments; frames overlapping a busy window are lost for every receiver
+  void setSeed(const uint32_t seed) { this->random_ = (seed != 0) ? seed : 1; }
+  void setLoss(const double probability) { this->loss_ = probability; }  // Per frame and receiver
+  void setPeriodicBusy(const uint64_t period, const uint64_t duration, const uint64_t offset = 0);
+  void addBusy(const uint64_t start, const uint64_t end);
+  void clearBusy(void);
+  bool busyAt(const uint64_t time) const;
+
+  // Held by every node access, the radio task of a simulated driver included
+  std::recursive_mutex &mutex(void) { return this->mutex_; }
+
+  uint32_t getFrames(void) const { return this->frameCount_; }
+  uint32_t getCollisions(void) const { return this->collisions_; }
+  uint32_t getLost(void) const { return this->lost_; }
+
+ protected:
+  bool busyDuring(const uint64_t start, const uint64_t end) const;
+  bool lose(void);
+
+  mutable std::recursive_mutex mutex_;
+
+  Transmission onAir_[AIR_MAX_FRAMES]{};
+  bool used_[AIR_MAX_FRAMES]{};
+  uint32_t nextId_{1};
+
+  AirNode *nodes_[AIR_MAX_NODES]{};
+  uint8_t nodeCount_{0};
+
+  double loss_{0.0};
+  uint32_t random_{1};
+  uint64_t busyPeriod_{0};
+  uint64_t busyDuration_{0};
+  uint64_t busyOffset_{0};
+  uint64_t busyStart_[AIR_MAX_BUSY_WINDOWS]{};
+  uint64_t busyEnd_[AIR_MAX_BUSY_WINDOWS]{};
+  uint8_t busyCount_{0};
+
+  uint32_t frameCount_{0};
+  uint32_t collisions_{0};
+  uint32_t lost_{0};
+};
+
+}  // namespace sim
@@ -0,0 +1,317 @@
+#include "main_unit.h"
+
+#include <string.h>
+
+namespace sim {
+
+// Frame layout
+enum {
+  RX_TYPE = 0,
+  RX_ID = 1,
+  TX_TYPE = 2,
+  TX_ID = 3,
+  TTL = 4,
+  COMMAND = 5,
+  PARAMETER_COUNT = 6,
+  PARAMETERS = 7,
+};
+
+enum {
+  TYPE_MAIN_UNIT = 0x01,
+  COMMAND_SETSPEED = 0x02,
+  COMMAND_SETTIMER = 0x03,
+  COMMAND_JOIN_REQUEST = 0x04,
+  COMMAND_SETSPEED_REPLY = 0x05,
+  COMMAND_JOIN_OPEN = 0x06,
+  COMMAND_FAN_SETTINGS = 0x07,
+  COMMAND_LINK_ACK = 0x0B,
+  COMMAND_JOIN_ACK = 0x0C,
+  COMMAND_QUERY_NETWORK = 0x0D,
+  COMMAND_QUERY_DEVICE = 0x10,
+};
+
+static const uint8_t VOLTAGES[] = {0, 30, 50, 90, 100};
+
+static void buildFrame(uint8_t *const pFrame, const uint8_t rxType, const uint8_t rxId, const uint8_t txType,
+                       const uint8_t txId, const uint8_t command, const uint8_t count) {
+  (void) memset(pFrame, 0, SIM_FRAMESIZE);
+  pFrame[RX_TYPE] = rxType;
+  pFrame[RX_ID] = rxId;
+  pFrame[TX_TYPE] = txType;
+  pFrame[TX_ID] = txId;
+  pFrame[TTL] = 0xFA;
+  pFrame[COMMAND] = command;
+  pFrame[PARAMETER_COUNT] = count;
+}
+
+static void putU32(uint8_t *const pBuffer, const uint32_t value) {
+  pBuffer[0] = value & 0xFF;
+  pBuffer[1] = (value >> 8) & 0xFF;
+  pBuffer[2] = (value >> 16) & 0xFF;
+  pBuffer[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t getU32(const uint8_t *const pBuffer) {
+  return pBuffer[0] | (pBuffer[1] << 8) | (pBuffer[2] << 16) | ((uint32_t) pBuffer[3] << 24);
+}
+
+Station::Station(Air &air) : air_(air) { this->air_.attach(this); }
+
+Station::~Station() { this->air_.detach(this); }
+
+void Station::send(const uint64_t at, const uint32_t address, const uint8_t *const pFrame, const uint8_t copies) {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+
+  if (this->queued_ >= SIM_STATION_QUEUE) {
+    return;
+  }
+  Burst *const pBurst = &this->queue_[this->queued_++];
+
+  pBurst->at = at;
+  pBurst->address = address;
+  (void) memcpy(pBurst->frame, pFrame, SIM_FRAMESIZE);
+  pBurst->copies = (copies > 0) ? copies : 1;
+}
+
+bool Station::reschedule(const uint8_t *const pFrame, const uint64_t at) {
+  for (uint8_t i = 0; i < this->queued_; ++i) {
+    if (memcmp(this->queue_[i].frame, pFrame, SIM_FRAMESIZE) == 0) {
+      this->queue_[i].at = at;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t Station::nextEvent() const {
+  uint64_t next = AIR_NEVER;
+
+  if (this->sending_) {
+    return this->copyEnd_;
+  }
+  for (uint8_t i = 0; i < this->queued_; ++i) {
+    if (this->queue_[i].at < next) {
+      next = this->queue_[i].at;
+    }
+  }
+  return next;
+}
+
+void Station::update(const uint64_t now) {
+  if (this->sending_ && (now >= this->copyEnd_)) {
+    if (this->current_.copies > 0) {
+      this->startCopy(this->copyEnd_);
+      return;
+    }
+    this->sending_ = false;
+  }
+  if (this->sending_) {
+    return;
+  }
+
+  // Earliest burst that is due
+  uint8_t first = SIM_STATION_QUEUE;
+
+  for (uint8_t i = 0; i < this->queued_; ++i) {
+    if ((this->queue_[i].at <= now) && ((first == SIM_STATION_QUEUE) || (this->queue_[i].at < this->queue_[first].at))) {
+      first = i;
+    }
+  }
+  if (first == SIM_STATION_QUEUE) {
+    return;
+  }
+
+  this->current_ = this->queue_[first];
+  --this->queued_;
+  for (uint8_t i = first; i < this->queued_; ++i) {
+    this->queue_[i] = this->queue_[i + 1];
+  }
+  this->burstStart_ = now;
+  this->startCopy(now);
+}
+
+void Station::startCopy(const uint64_t now) {
+  Transmission tx{};
+
+  tx.start = now;
+  tx.end = now + frameAirTime(4, SIM_FRAMESIZE, 16);
+  tx.channel = SIM_CHANNEL;
+  tx.band = SIM_BAND;
+  putU32(tx.address, this->current_.address);
+  tx.addressWidth = 4;
+  (void) memcpy(tx.payload, this->current_.frame, SIM_FRAMESIZE);
+  tx.length = SIM_FRAMESIZE;
+  tx.sender = this;
+
+  --this->current_.copies;
+  this->sending_ = true;
+  this->copyEnd_ = tx.end;
+  ++this->framesSent_;
+  (void) this->air_.transmit(tx);
+}
+
+bool Station::heardDuringOwnTx(const Transmission &tx) const {
+  return this->sending_ && (tx.start < this->copyEnd_) && (tx.end > this->burstStart_);
+}
+
+MainUnit::MainUnit(Air &air, const uint32_t networkId, const uint8_t id) : Station(air), networkId_(networkId), id_(id) {}
+
+void MainUnit::setReplyDelay(const uint32_t minUs, const uint32_t maxUs) {
+  this->replyMin_ = minUs * 1000;
+  this->replyMax_ = ((maxUs > minUs) ? maxUs : minUs) * 1000;
+}
+
+void MainUnit::setSpeed(const uint8_t speed) {
+  this->speed_ = (speed < sizeof(VOLTAGES)) ? speed : 0;
+  this->timerEnd_ = 0;
+}
+
+uint8_t MainUnit::getVoltage(void) const { return VOLTAGES[(this->speed_ < sizeof(VOLTAGES)) ? this->speed_ : 0]; }
+
+uint8_t MainUnit::getTimer(const uint64_t now) const {
+  if ((this->timerEnd_ == 0) || (this->timerEnd_ <= now)) {
+    return 0;
+  }
+  return (uint8_t) (((this->timerEnd_ - now) + 59999999999ULL) / 60000000000ULL);
+}
+
+uint64_t MainUnit::replyDelay(void) {
+  this->random_ ^= this->random_ << 13;
+  this->random_ ^= this->random_ >> 17;
+  this->random_ ^= this->random_ << 5;
+
+  return this->replyMin_ + ((this->replyMax_ > this->replyMin_) ? (this->random_ % (this->replyMax_ - this->replyMin_))
+                                                                 : 0);
+}
+
+uint64_t MainUnit::nextEvent() const {
+  const uint64_t next = Station::nextEvent();
+
+  return ((this->timerEnd_ != 0) && (this->timerEnd_ < next)) ? this->timerEnd_ : next;
+}
+
+void MainUnit::update(const uint64_t now) {
+  if ((this->timerEnd_ != 0) && (now >= this->timerEnd_)) {
+    this->timerEnd_ = 0;
+    this->speed_ = this->timerSpeed_;
+  }
+  Station::update(now);
+}
+
+void MainUnit::onAirEnd(const Transmission &tx, const bool corrupted) {
+  const uint32_t address = getU32(tx.address);
+
+  if ((tx.sender == this) || corrupted || (tx.channel != SIM_CHANNEL) || (tx.band != SIM_BAND) ||
+      (tx.addressWidth != 4) || (tx.length < SIM_FRAMESIZE) || this->heardDuringOwnTx(tx)) {
+    return;
+  }
+  if ((address != this->networkId_) && ((this->pairing_ == false) || (address != SIM_LINK_ID))) {
+    return;
+  }
+
+  // Remotes repeat every frame a few times; answer once, after the last copy
+  if ((memcmp(tx.payload, this->lastRequest_, SIM_FRAMESIZE) == 0) &&
+      ((tx.start - this->lastRequestEnd_) < SIM_DUPLICATE_WINDOW)) {
+    this->lastRequestEnd_ = tx.end;
+    (void) this->reschedule(this->lastReply_, tx.end + this->replyDelay());
+    return;
+  }
+  (void) memcpy(this->lastRequest_, tx.payload, SIM_FRAMESIZE);
+  this->lastRequestEnd_ = tx.end;
+  (void) memset(this->lastReply_, 0, SIM_FRAMESIZE);
+
+  this->handle(tx.payload, address, tx.end);
+}
+
+void MainUnit::handle(const uint8_t *const pFrame, const uint32_t address, const uint64_t now) {
+  uint8_t frame[SIM_FRAMESIZE];
+  const bool forUs = (pFrame[RX_TYPE] == TYPE_MAIN_UNIT) && (pFrame[RX_ID] == this->id_);
+
+  switch (pFrame[COMMAND]) {
+    case COMMAND_JOIN_ACK:
+      // Remote available for linking; offer the network
+      if (address == SIM_LINK_ID) {
+        buildFrame(frame, pFrame[TX_TYPE], pFrame[TX_ID], TYPE_MAIN_UNIT, this->id_, COMMAND_JOIN_OPEN, 4);
+        putU32(&frame[PARAMETERS], this->networkId_);
+        this->reply(now, SIM_LINK_ID, frame);
+      }
+      break;
+
+    case COMMAND_JOIN_REQUEST:
+      if ((address == this->networkId_) && forUs && (getU32(&pFrame[PARAMETERS]) == this->networkId_)) {
+        this->linkedId_ = pFrame[TX_ID];
+        buildFrame(frame, pFrame[TX_TYPE], pFrame[TX_ID], TYPE_MAIN_UNIT, this->id_, COMMAND_LINK_ACK, 0);
+        this->reply(now, this->networkId_, frame);
+      }
+      break;
+
+    case COMMAND_LINK_ACK:
+      if (forUs && (pFrame[TX_ID] == this->linkedId_)) {
+        this->linked_ = true;
+        this->pairing_ = false;
+        buildFrame(frame, TYPE_MAIN_UNIT, this->id_, TYPE_MAIN_UNIT, this->id_, COMMAND_QUERY_NETWORK, 0);
+        this->reply(now, this->networkId_, frame);
+      }
+      break;
+
+    case COMMAND_QUERY_DEVICE:
+      if (forUs) {
+        ++this->queries_;
+        this->replySettings(now, pFrame[TX_TYPE], pFrame[TX_ID]);
+      }
+      break;
+
+    case COMMAND_SETSPEED:
+    case COMMAND_SETTIMER:
+      if ((pFrame[RX_TYPE] == TYPE_MAIN_UNIT) && ((pFrame[RX_ID] == 0x00) || (pFrame[RX_ID] == this->id_))) {
+        ++this->setSpeeds_;
+        if ((pFrame[COMMAND] == COMMAND_SETTIMER) && (pFrame[PARAMETERS + 1] > 0)) {
+          if (this->timerEnd_ == 0) {
+            this->timerSpeed_ = this->speed_;
+          }
+          this->timerEnd_ = now + (pFrame[PARAMETERS + 1] * 60000000000ULL);
+        } else {
+          this->timerEnd_ = 0;
+        }
+        this->speed_ = (pFrame[PARAMETERS] < sizeof(VOLTAGES)) ? pFrame[PARAMETERS] : 0;
+        this->replySettings(now, pFrame[TX_TYPE], pFrame[TX_ID]);
+      }
+      break;
+
+    case COMMAND_SETSPEED_REPLY:
+      if (forUs) {
+        ++this->setSpeedReplies_;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+void MainUnit::replySettings(const uint64_t now, const uint8_t rxType, const uint8_t rxId) {
+  uint8_t frame[SIM_FRAMESIZE];
+
+  buildFrame(frame, rxType, rxId, TYPE_MAIN_UNIT, this->id_, COMMAND_FAN_SETTINGS, 3);
+  frame[PARAMETERS] = this->speed_;
+  frame[PARAMETERS + 1] = this->getVoltage();
+  frame[PARAMETERS + 2] = this->getTimer(now);
+  this->reply(now, this->networkId_, frame);
+}
+
+void MainUnit::reply(const uint64_t now, const uint32_t address, const uint8_t *const pFrame) {
+  (void) memcpy(this->lastReply_, pFrame, SIM_FRAMESIZE);
+  this->send(now + this->replyDelay(), address, pFrame, this->replyFrames_);
+}
+
+void Remote::sendSetSpeed(const uint64_t at, const uint8_t speed, const uint8_t timer) {
+  uint8_t frame[SIM_FRAMESIZE];
+
+  buildFrame(frame, TYPE_MAIN_UNIT, 0x00, 0x03, this->id_, (timer > 0) ? COMMAND_SETTIMER : COMMAND_SETSPEED,
+             (timer > 0) ? 2 : 1);
+  frame[PARAMETERS] = speed;
+  frame[PARAMETERS + 1] = timer;
+  this->send(at, this->networkId_, frame, 4);
+}
+
+}  // namespace sim
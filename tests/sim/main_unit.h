@@ -0,0 +1,124 @@
+#pragma once
+
+// Frame level Zehnder/BUVA devices for the simulation: a main unit that pairs, answers polls and takes speed
+// commands, and a wall remote. Frames are built here byte by byte, independent of the component's rf_frame.h.
+
+#include <stdint.h>
+
+#include "air.h"
+
+namespace sim {
+
+#define SIM_CHANNEL 118
+#define SIM_BAND true                // 868MHz
+#define SIM_FRAMESIZE 16
+#define SIM_LINK_ID 0xA55A5AA5       // Network ID while linking
+#define SIM_STATION_QUEUE 8          // Bursts waiting to go on air
+#define SIM_DUPLICATE_WINDOW 30000000  // Same request again within 30ms is a copy from the same burst (in ns)
+
+// Frame level radio: 16 byte frames in bursts, always listening while not sending
+class Station : public AirNode {
+ public:
+  explicit Station(Air &air);
+  ~Station() override;
+
+  // copies back to back, the first one at (or after) at
+  void send(const uint64_t at, const uint32_t address, const uint8_t *const pFrame, const uint8_t copies);
+  bool reschedule(const uint8_t *const pFrame, const uint64_t at);  // Queued burst with this frame, not yet on air
+
+  uint64_t nextEvent() const override;
+  void update(const uint64_t now) override;
+
+  uint32_t getFramesSent(void) const { return this->framesSent_; }
+
+ protected:
+  typedef struct {
+    uint64_t at;
+    uint32_t address;
+    uint8_t frame[SIM_FRAMESIZE];
+    uint8_t copies;
+  } Burst;
+
+  void startCopy(const uint64_t now);
+  bool heardDuringOwnTx(const Transmission &tx) const;  // Half duplex
+
+  Air &air_;
+  Burst queue_[SIM_STATION_QUEUE]{};
+  uint8_t queued_{0};
+  Burst current_{};
+  bool sending_{false};
+  uint64_t burstStart_{0};
+  uint64_t copyEnd_{0};
+  uint32_t framesSent_{0};
+};
+
+class MainUnit : public Station {
+ public:
+  MainUnit(Air &air, const uint32_t networkId, const uint8_t id);
+
+  void setPairing(const bool open) { this->pairing_ = open; }
+  void setReplyDelay(const uint32_t minUs, const uint32_t maxUs);
+  void setReplyFrames(const uint8_t frames) { this->replyFrames_ = frames; }
+  void setSeed(const uint32_t seed) { this->random_ = (seed != 0) ? seed : 1; }
+
+  // Button on the unit itself; nothing on air
+  void setSpeed(const uint8_t speed);
+
+  uint32_t getNetworkId(void) const { return this->networkId_; }
+  uint8_t getId(void) const { return this->id_; }
+  uint8_t getSpeed(void) const { return this->speed_; }
+  uint8_t getVoltage(void) const;
+  uint8_t getTimer(const uint64_t now) const;  // Minutes left
+  bool isLinked(const uint8_t remoteId) const { return this->linked_ && (this->linkedId_ == remoteId); }
+
+  uint32_t getQueries(void) const { return this->queries_; }
+  uint32_t getSetSpeeds(void) const { return this->setSpeeds_; }
+  uint32_t getSetSpeedReplies(void) const { return this->setSpeedReplies_; }
+
+  void onAirEnd(const Transmission &tx, const bool corrupted) override;
+  uint64_t nextEvent() const override;
+  void update(const uint64_t now) override;
+
+ protected:
+  void handle(const uint8_t *const pFrame, const uint32_t address, const uint64_t now);
+  void reply(const uint64_t now, const uint32_t address, const uint8_t *const pFrame);
+  void replySettings(const uint64_t now, const uint8_t rxType, const uint8_t rxId);
+  uint64_t replyDelay(void);
+
+  uint32_t networkId_;
+  uint8_t id_;
+  bool pairing_{false};
+  bool linked_{false};
+  uint8_t linkedId_{0};
+
+  uint8_t speed_{1};
+  uint8_t timerSpeed_{1};   // Speed to return to when the timer runs out
+  uint64_t timerEnd_{0};    // ns, 0 when no timer runs
+
+  uint32_t replyMin_{15000000};  // ns
+  uint32_t replyMax_{30000000};  // ns
+  uint8_t replyFrames_{4};
+  uint32_t random_{0x5EED};
+
+  uint8_t lastRequest_[SIM_FRAMESIZE]{};
+  uint64_t lastRequestEnd_{0};
+  uint8_t lastReply_[SIM_FRAMESIZE]{};  // Reply to lastRequest_, moved back by every further copy of it
+
+  uint32_t queries_{0};
+  uint32_t setSpeeds_{0};
+  uint32_t setSpeedReplies_{0};
+};
+
+// Another remote on the network; its traffic is overheard by the component
+class Remote : public Station {
+ public:
+  Remote(Air &air, const uint32_t networkId, const uint8_t id) : Station(air), networkId_(networkId), id_(id) {}
+
+  void sendSetSpeed(const uint64_t at, const uint8_t speed, const uint8_t timer = 0);
+
+ protected:
+  uint32_t networkId_;
+  uint8_t id_;
+};
+
+}  // namespace sim
@@ -0,0 +1,430 @@
+#include "nrf905_model.h"
+
+#include <string.h>
+
+#include "host.h"
+
+namespace sim {
+
+static const uint8_t RESET_REGISTERS[10] = {0x6C, 0x00, 0x44, 0x20, 0x20, 0xE7, 0xE7, 0xE7, 0xE7, 0xE7};
+
+static SpiCommandClass classify(const uint8_t command) {
+  switch (command) {
+    case 0xFF:
+      return SpiNop;
+    case 0x20:
+      return SpiWTxPayload;
+    case 0x21:
+      return SpiRTxPayload;
+    case 0x22:
+      return SpiWTxAddress;
+    case 0x23:
+      return SpiRTxAddress;
+    case 0x24:
+      return SpiRRxPayload;
+    default:
+      break;
+  }
+  switch (command & 0xF0) {
+    case 0x00:
+      return SpiWConfig;
+    case 0x10:
+      return SpiRConfig;
+    case 0x80:
+      return SpiChannelConfig;
+    default:
+      return SpiInvalid;
+  }
+}
+
+bool SimPin::digital_read() { return this->model_->pinRead(this->id_); }
+
+void SimPin::digital_write(bool value) {
+  if ((this->id_ == PinPwr) || (this->id_ == PinCe) || (this->id_ == PinTxen)) {
+    this->level_ = value;
+    this->model_->pinWritten(this->id_);
+  } else if (this->id_ == PinCs) {
+    this->level_ = value;
+  }
+}
+
+void SimPin::set(const bool level) {
+  if (level == this->level_) {
+    return;
+  }
+  this->level_ = level;
+  if (this->isr_ != nullptr) {
+    this->isr_(this->isrArg_);
+  }
+}
+
+void SimPin::attach_interrupt(void (*func)(void *), void *arg, esphome::gpio::InterruptType type) const {
+  (void) type;  // Any edge
+  this->isr_ = func;
+  this->isrArg_ = arg;
+}
+
+Nrf905Model::Nrf905Model(Air &air) : air_(air) {
+  this->reset();
+  this->air_.attach(this);
+}
+
+Nrf905Model::~Nrf905Model() { this->air_.detach(this); }
+
+void Nrf905Model::reset(void) {
+  (void) memcpy(this->reg_, RESET_REGISTERS, sizeof(this->reg_));
+  (void) memset(this->txAddress_, 0xE7, sizeof(this->txAddress_));
+  (void) memset(this->txPayload_, 0, sizeof(this->txPayload_));
+  (void) memset(this->rxPayload_, 0, sizeof(this->rxPayload_));
+}
+
+void Nrf905Model::resetCounters(void) {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+
+  this->counters_ = {};
+}
+
+uint32_t Nrf905Model::rxAddress(void) const {
+  return this->reg_[5] | (this->reg_[6] << 8) | (this->reg_[7] << 16) | ((uint32_t) this->reg_[8] << 24);
+}
+
+uint32_t Nrf905Model::txAddress(void) const {
+  return this->txAddress_[0] | (this->txAddress_[1] << 8) | (this->txAddress_[2] << 16) |
+         ((uint32_t) this->txAddress_[3] << 24);
+}
+
+uint8_t Nrf905Model::crcBits(void) const {
+  if ((this->reg_[9] & 0x40) == 0) {
+    return 0;
+  }
+  return (this->reg_[9] & 0x80) ? 16 : 8;
+}
+
+bool Nrf905Model::receiving(void) const {
+  return this->rxMode_ && (esphome::host::now_ns() >= this->settleAt_);
+}
+
+uint8_t Nrf905Model::status(void) const {
+  return (this->dr.level() ? (1 << 5) : 0) | (this->am.level() ? (1 << 7) : 0);
+}
+
+void Nrf905Model::sync(void) { this->air_.update(esphome::host::now_ns()); }
+
+void Nrf905Model::pinWritten(const PinId id) {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+
+  (void) id;
+  this->sync();
+  ++this->counters_.pinWrites;
+  this->applyPins(esphome::host::now_ns());
+}
+
+bool Nrf905Model::pinRead(const PinId id) {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+  const uint64_t now = esphome::host::now_ns();
+
+  this->sync();
+  switch (id) {
+    case PinDr:
+      return this->dr.level();
+    case PinAm:
+      return this->am.level();
+    case PinCd:
+      // Carrier detect only works in RX
+      return this->receiving() && this->air_.carrier(now, this->channel(), this->band(), this);
+    case PinPwr:
+      return this->pwr.level();
+    case PinCe:
+      return this->ce.level();
+    case PinTxen:
+      return this->txen.level();
+    default:
+      return this->cs.level();
+  }
+}
+
+void Nrf905Model::applyPins(const uint64_t now) {
+  const bool powered = this->pwr.level();
+  const bool rx = powered && this->ce.level() && !this->txen.level();
+  const bool tx = powered && this->ce.level() && this->txen.level();
+
+  if (powered && !this->powered_) {
+    this->readyAt_ = now + NRF905_MODEL_POWER_UP;
+  }
+  if (!powered && this->powered_) {
+    this->setDr(false);
+    this->setAm(false);
+  }
+  this->powered_ = powered;
+
+  if (this->rxMode_ && !rx) {
+    // Frame being received is lost
+    this->rxActive_ = false;
+    this->setAm(false);
+  }
+  if (rx && !this->rxMode_) {
+    this->settleAt_ = ((now > this->readyAt_) ? now : this->readyAt_) + NRF905_MODEL_SETTLE;
+    if (this->drFromTx_) {
+      this->setDr(false);
+    }
+  }
+
+  if (this->txActive_ && (!powered || !this->txen.level())) {
+    // Only TRX_CE low lets the frame on air finish; without TX_EN or power it stops right away
+    this->air_.cut(this->txId_, now);
+    this->txActive_ = false;
+    this->txId_ = 0;
+    ++this->counters_.framesCut;
+  }
+
+  if (tx && !this->txMode_ && ((now - this->txLeftAt_) < NRF905_MODEL_CE_PULSE)) {
+    // Too short a TRX_CE low for the radio to leave TX; no new frame
+    ++this->counters_.violations;
+  } else if (tx && !this->txMode_) {
+    if (this->txActive_) {
+      this->txRestart_ = true;
+    } else {
+      this->txPending_ = true;
+      this->settleAt_ = ((now > this->readyAt_) ? now : this->readyAt_) + NRF905_MODEL_SETTLE;
+    }
+  }
+  if (!tx) {
+    // CE dropped before the frame started; one on air is completed
+    this->txPending_ = false;
+    this->txRestart_ = false;
+  }
+  if (!tx && this->txMode_) {
+    this->txLeftAt_ = now;
+    if (this->drFromTx_) {
+      // Leaving TX clears the DR of the last frame sent
+      this->setDr(false);
+    }
+  }
+
+  this->rxMode_ = rx;
+  this->txMode_ = tx;
+}
+
+uint64_t Nrf905Model::nextEvent() const {
+  uint64_t next = AIR_NEVER;
+
+  if (this->txPending_) {
+    next = this->settleAt_;
+  }
+  if (this->rxActive_ && this->rxMatch_ && !this->amRaised_ && (this->amAt_ < next)) {
+    next = this->amAt_;
+  }
+
+  return next;
+}
+
+void Nrf905Model::update(const uint64_t now) {
+  if (this->txPending_ && (now >= this->settleAt_)) {
+    this->txPending_ = false;
+    this->startFrame(now, false);
+  }
+  if (this->rxActive_ && this->rxMatch_ && !this->amRaised_ && (now >= this->amAt_)) {
+    this->amRaised_ = true;
+    this->setAm(true);
+  }
+}
+
+void Nrf905Model::startFrame(const uint64_t now, const bool retransmit) {
+  Transmission tx{};
+
+  if (this->txFault_) {
+    return;
+  }
+
+  tx.start = now;
+  tx.end = now + frameAirTime(this->txAddressWidth(), this->txPayloadWidth(), this->crcBits());
+  tx.channel = this->channel();
+  tx.band = this->band();
+  (void) memcpy(tx.address, this->txAddress_, sizeof(tx.address));
+  tx.addressWidth = this->txAddressWidth();
+  tx.length = (this->txPayloadWidth() <= 32) ? this->txPayloadWidth() : 32;
+  (void) memcpy(tx.payload, this->txPayload_, tx.length);
+  tx.sender = this;
+
+  // DR of the previous frame stays up through AUTO_RETRAN repeats; a new TRX_CE pulse clears it
+  if (!retransmit) {
+    this->setDr(false);
+  }
+  this->txActive_ = true;
+  this->txId_ = this->air_.transmit(tx);
+}
+
+void Nrf905Model::onAirStart(const Transmission &tx) {
+  const uint8_t width = this->rxAddressWidth();
+
+  if (!this->rxMode_ || (tx.start < this->settleAt_) || (tx.channel != this->channel()) ||
+      (tx.band != this->band())) {
+    return;
+  }
+  const bool match = (tx.addressWidth == width) && (memcmp(tx.address, &this->reg_[5], width) == 0);
+
+  if (this->rxActive_ || this->dr.level()) {
+    // Busy with another frame, or the last payload was never read
+    if (match) {
+      ++this->counters_.framesMissed;
+    }
+    return;
+  }
+
+  this->rxActive_ = true;
+  this->rxFrame_ = tx;
+  this->rxMatch_ = match;
+  this->amRaised_ = false;
+  this->amAt_ = tx.start + ((10 + (8 * width)) * (uint64_t) AIR_BIT_TIME);
+}
+
+void Nrf905Model::onAirEnd(const Transmission &tx, const bool corrupted) {
+  if (tx.sender == this) {
+    if (tx.id != this->txId_) {
+      return;
+    }
+    this->txActive_ = false;
+    ++this->counters_.framesSent;
+    this->setDr(true);
+    this->drFromTx_ = true;
+
+    // AUTO_RETRAN repeats for as long as TRX_CE stays high, else a new CE pulse starts the next frame
+    if (this->txMode_ && (this->autoRetransmit() || this->txRestart_)) {
+      this->startFrame(tx.end, !this->txRestart_);
+      this->txRestart_ = false;
+    }
+    return;
+  }
+
+  if (!this->rxActive_ || (tx.id != this->rxFrame_.id)) {
+    return;
+  }
+  this->rxActive_ = false;
+  if (!this->rxMatch_) {
+    return;
+  }
+
+  if (corrupted) {
+    ++this->counters_.crcErrors;
+    this->setAm(false);
+    return;
+  }
+
+  const uint8_t width = this->rxPayloadWidth();
+
+  (void) memset(this->rxPayload_, 0, sizeof(this->rxPayload_));
+  (void) memcpy(this->rxPayload_, tx.payload, (tx.length < width) ? tx.length : width);
+  ++this->counters_.framesReceived;
+  this->drFromTx_ = false;
+  this->setDr(true);
+}
+
+void Nrf905Model::setDr(const bool level) { this->dr.set(level); }
+
+void Nrf905Model::setAm(const bool level) { this->am.set(level); }
+
+bool Nrf905Model::writeAllowed(void) { return !this->rxMode_ && !this->txMode_ && !this->txActive_; }
+
+void Nrf905Model::begin_transaction() {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+
+  this->sync();
+  this->selected_ = true;
+  this->index_ = 0;
+  this->violation_ = false;
+}
+
+uint8_t Nrf905Model::transfer(uint8_t data) {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+  const uint8_t index = this->index_ - 1;  // Data byte index
+  uint8_t out = 0x00;
+
+  ++this->counters_.bytes;
+  if (this->index_ == 0) {
+    this->command_ = data;
+    this->index_ = 1;
+    return this->status();
+  }
+  if (this->index_ < UINT8_MAX) {
+    ++this->index_;
+  }
+
+  const size_t reg = (size_t) (this->command_ & 0x0F) + index;  // Config register for W_CONFIG/R_CONFIG
+
+  switch (classify(this->command_)) {
+    case SpiWConfig:
+      if (reg < sizeof(this->reg_)) {
+        this->violation_ |= !this->writeAllowed();
+        this->reg_[reg] = data;
+      }
+      break;
+
+    case SpiRConfig:
+      if (reg < sizeof(this->reg_)) {
+        out = this->reg_[reg];
+      }
+      break;
+
+    case SpiWTxPayload:
+      if (index < sizeof(this->txPayload_)) {
+        this->violation_ |= !this->writeAllowed();
+        this->txPayload_[index] = data;
+      }
+      break;
+
+    case SpiRTxPayload:
+      out = (index < sizeof(this->txPayload_)) ? this->txPayload_[index] : 0x00;
+      break;
+
+    case SpiWTxAddress:
+      if (index < sizeof(this->txAddress_)) {
+        this->violation_ |= !this->writeAllowed();
+        this->txAddress_[index] = data;
+      }
+      break;
+
+    case SpiRTxAddress:
+      out = (index < sizeof(this->txAddress_)) ? this->txAddress_[index] : 0x00;
+      break;
+
+    case SpiRRxPayload:
+      out = (index < sizeof(this->rxPayload_)) ? this->rxPayload_[index] : 0x00;
+      break;
+
+    case SpiChannelConfig:
+      if (index == 0) {
+        this->violation_ |= !this->writeAllowed();
+        this->reg_[0] = data;
+        this->reg_[1] = (this->reg_[1] & 0xF0) | (this->command_ & 0x0F);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return out;
+}
+
+void Nrf905Model::end_transaction() {
+  std::lock_guard<std::recursive_mutex> lock(this->air_.mutex());
+  const SpiCommandClass command = classify(this->command_);
+
+  this->selected_ = false;
+  if (this->index_ == 0) {
+    return;  // Nothing clocked
+  }
+  ++this->counters_.transactions;
+  ++this->counters_.commands[command];
+  if (this->violation_) {
+    ++this->counters_.violations;
+  }
+
+  // Reading the payload clears DR and AM
+  if ((command == SpiRRxPayload) && (this->index_ > 1)) {
+    this->setDr(false);
+    this->setAm(false);
+  }
+}
+
+}  // namespace sim
@@ -0,0 +1,187 @@
+#pragma once
+
+// Register level nRF905: decodes the SPI commands, holds the config/address/payload registers and drives
+// DR/AM/CD from what happens on the air. Timing from the datasheet: 3ms power-up, 650us standby to RX/TX.
+
+#include <stdint.h>
+
+#include <string>
+
+#include "air.h"
+#include "esphome/core/hal.h"
+#include "esphome/components/spi/spi.h"
+
+namespace sim {
+
+#define NRF905_MODEL_POWER_UP 3000000  // PowerDown to standby (in ns)
+#define NRF905_MODEL_SETTLE 650000     // Standby to RX or TX (in ns)
+#define NRF905_MODEL_CE_PULSE 10000    // Shortest TRX_CE low that ends TX (in ns)
+
+class Nrf905Model;
+
+typedef enum {
+  PinPwr,
+  PinCe,
+  PinTxen,
+  PinCs,
+  PinDr,
+  PinAm,
+  PinCd,
+
+  PinNrOf  // Keep last
+} PinId;
+
+class SimPin : public esphome::InternalGPIOPin {
+ public:
+  SimPin(Nrf905Model *const pModel, const PinId id, const char *const name) : model_(pModel), id_(id), name_(name) {}
+
+  void setup() override {}
+  bool digital_read() override;
+  void digital_write(bool value) override;
+  std::string dump_summary() const override { return this->name_; }
+
+  bool level(void) const { return this->level_; }
+  void set(const bool level);  // Output of the radio, runs the ISR on a change
+
+ protected:
+  void attach_interrupt(void (*func)(void *), void *arg, esphome::gpio::InterruptType type) const override;
+
+  Nrf905Model *model_;
+  PinId id_;
+  const char *name_;
+  bool level_{false};
+  mutable void (*isr_)(void *){nullptr};
+  mutable void *isrArg_{nullptr};
+};
+
+typedef enum {
+  SpiWConfig,
+  SpiRConfig,
+  SpiWTxPayload,
+  SpiRTxPayload,
+  SpiWTxAddress,
+  SpiRTxAddress,
+  SpiRRxPayload,
+  SpiChannelConfig,
+  SpiNop,
+  SpiInvalid,
+
+  SpiNrOf  // Keep last
+} SpiCommandClass;
+
+typedef struct {
+  uint32_t transactions;             // Chip select cycles
+  uint32_t bytes;                    // Bytes clocked, command byte included
+  uint32_t commands[SpiNrOf];        // Transactions per command
+  uint32_t pinWrites;                // PWR/CE/TXEN writes
+  uint32_t framesSent;               // Frames put on air
+  uint32_t framesCut;                // Frames cut short by TX_EN or PWR_UP dropping before their end
+  uint32_t framesReceived;           // Valid frames with a matching address, DR raised
+  uint32_t framesMissed;             // Matching frames not received: DR still set or not settled in RX
+  uint32_t crcErrors;                // Address matched, frame corrupted
+  uint32_t violations;               // Register/payload writes outside standby, payload writes during a frame,
+                                     // TRX_CE pulses shorter than NRF905_MODEL_CE_PULSE
+} ModelCounters;
+
+class Nrf905Model : public esphome::spi::SPIComponent, public AirNode {
+ public:
+  explicit Nrf905Model(Air &air);
+  ~Nrf905Model() override;
+
+  SimPin pwr{this, PinPwr, "PWR"};
+  SimPin ce{this, PinCe, "CE"};
+  SimPin txen{this, PinTxen, "TXEN"};
+  SimPin cs{this, PinCs, "CS"};
+  SimPin dr{this, PinDr, "DR"};
+  SimPin am{this, PinAm, "AM"};
+  SimPin cd{this, PinCd, "CD"};
+
+  // SPIComponent
+  void begin_transaction() override;
+  uint8_t transfer(uint8_t data) override;
+  void end_transaction() override;
+
+  // AirNode
+  void onAirStart(const Transmission &tx) override;
+  void onAirEnd(const Transmission &tx, const bool corrupted) override;
+  uint64_t nextEvent() const override;
+  void update(const uint64_t now) override;
+
+  // Pins, called by SimPin
+  void pinWritten(const PinId id);
+  bool pinRead(const PinId id);
+
+  // Inspection
+  const uint8_t *registers(void) const { return this->reg_; }
+  uint32_t rxAddress(void) const;
+  uint32_t txAddress(void) const;
+  uint16_t channel(void) const { return this->reg_[0] | ((this->reg_[1] & 0x01) << 8); }
+  bool band(void) const { return (this->reg_[1] & 0x02) != 0; }
+  bool autoRetransmit(void) const { return (this->reg_[1] & 0x20) != 0; }
+  const uint8_t *txPayload(void) const { return this->txPayload_; }
+  bool transmitting(void) const { return this->txActive_; }
+  bool receiving(void) const;  // RX mode and settled
+  uint8_t status(void) const;
+
+  const ModelCounters &counters(void) const { return this->counters_; }
+  void resetCounters(void);
+
+  // Power-on reset values, as after a cold boot
+  void reset(void);
+
+  // Broken PA or antenna: TX mode is entered but no frame ever goes out, DR stays low
+  void setTxFault(const bool fault) { this->txFault_ = fault; }
+
+ protected:
+  void sync(void);
+  void applyPins(const uint64_t now);
+  void startFrame(const uint64_t now, const bool retransmit);
+  void setDr(const bool level);
+  void setAm(const bool level);
+  bool writeAllowed(void);
+  uint8_t rxAddressWidth(void) const { return this->reg_[2] & 0x07; }
+  uint8_t txAddressWidth(void) const { return (this->reg_[2] >> 4) & 0x07; }
+  uint8_t rxPayloadWidth(void) const { return this->reg_[3] & 0x3F; }
+  uint8_t txPayloadWidth(void) const { return this->reg_[4] & 0x3F; }
+  uint8_t crcBits(void) const;
+
+  Air &air_;
+
+  uint8_t reg_[10];
+  uint8_t txAddress_[4];
+  uint8_t txPayload_[32];
+  uint8_t rxPayload_[32];
+
+  // Mode as the pins left it
+  bool powered_{false};
+  bool rxMode_{false};
+  bool txMode_{false};
+  uint64_t readyAt_{0};    // Power-up done
+  uint64_t settleAt_{0};   // RX/TX usable
+
+  // TX
+  bool txPending_{false};  // Frame starts at settleAt_
+  bool txActive_{false};   // Frame on air
+  bool txRestart_{false};  // CE pulsed while a frame was on air
+  uint32_t txId_{0};
+  uint64_t txLeftAt_{0};   // TRX_CE or TX_EN last dropped in TX
+  bool drFromTx_{false};   // DR means frame sent, cleared when leaving TX
+  bool txFault_{false};
+
+  // RX, the frame being received
+  bool rxActive_{false};
+  Transmission rxFrame_{};
+  bool rxMatch_{false};
+  bool amRaised_{false};
+  uint64_t amAt_{0};
+
+  // SPI transaction
+  bool selected_{false};
+  uint8_t command_{0};
+  uint8_t index_{0};
+  bool violation_{false};
+
+  ModelCounters counters_{};
+};
+
+}  // namespace sim
@@ -0,0 +1,132 @@
+#include "simulation.h"
+
+#include <chrono>
+#include <thread>
+
+#include "esphome/core/helpers.h"
+
+namespace sim {
+
+Simulation::Simulation(const SimulationOptions &options) : options(options) {
+  esphome::host::set_time_ns(SIM_START_TIME);
+  esphome::host::seed_random(options.seed);
+  esphome::host::clear_scheduler();
+  esphome::host::clear_preferences();
+  this->air.setSeed(options.seed);
+
+  this->rf.set_spi_parent(&this->radio);
+  this->rf.set_cs_pin(&this->radio.cs);
+  this->rf.set_pwr_pin(&this->radio.pwr);
+  this->rf.set_ce_pin(&this->radio.ce);
+  this->rf.set_txen_pin(&this->radio.txen);
+  if (options.interruptPins) {
+    this->rf.set_dr_pin(&this->radio.dr);
+    this->rf.set_am_pin(&this->radio.am);
+  }
+  if (options.carrierPin) {
+    this->rf.set_cd_pin(&this->radio.cd);
+  }
+  this->rf.set_auto_retransmit(options.autoRetransmit);
+  this->rf.set_radio_task(options.radioTask);
+  this->rf.set_spi_trace_size(options.traceSize);
+}
+
+Simulation::~Simulation() { esphome::host::clear_scheduler(); }
+
+void Simulation::boot(void) {
+  this->rf.setup();
+  for (esphome::Component *const pComponent : this->components_) {
+    pComponent->setup();
+  }
+  this->nextLoop_ = esphome::host::now_ns();
+}
+
+void Simulation::runFor(const uint32_t ms) {
+  const uint64_t limit = esphome::host::now_ns() + (ms * 1000000ULL);
+
+  while (esphome::host::now_ns() < limit) {
+    this->step(limit);
+  }
+}
+
+void Simulation::loop(void) {
+  esphome::host::run_scheduler();
+  this->rf.loop();
+  for (esphome::Component *const pComponent : this->components_) {
+    pComponent->loop();
+  }
+  ++this->loops_;
+}
+
+void Simulation::step(const uint64_t limit) {
+  uint64_t now = esphome::host::now_ns();
+
+  this->air.update(now);
+  if (now >= this->nextLoop_) {
+    this->loop();
+    now = esphome::host::now_ns();
+    if (this->options.loopPeriod != 0) {
+      this->nextLoop_ = now + this->options.loopPeriod;
+    } else {
+      this->nextLoop_ =
+          now + (esphome::HighFrequencyLoopRequester::is_high_frequency() ? SIM_LOOP_FAST : SIM_LOOP_INTERVAL);
+    }
+  }
+
+  uint64_t next = this->nextLoop_;
+  const uint64_t event = this->air.nextEvent();
+
+  if (event < next) {
+    next = event;
+  }
+  if (limit < next) {
+    next = limit;
+  }
+  if (this->options.radioTask) {
+    // The radio task polls on its own; hand it real time in small steps
+    if (next > now + 1000000) {
+      next = now + 1000000;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+  esphome::host::advance_to_ns(next);
+  this->air.update(esphome::host::now_ns());
+}
+
+FanSimulation::FanSimulation(const SimulationOptions &options)
+    : Simulation(options), mainUnit(this->air, options.networkId, options.mainUnitId) {
+  this->mainUnit.setSeed(options.seed);
+  this->mainUnit.setPairing(!options.paired);
+
+  if (options.paired) {
+    FanProbe::Config config{};
+    esphome::ESPPreferenceObject pref =
+        esphome::global_preferences->make_preference<FanProbe::Config>(esphome::fnv1_hash("zehnderrf"), true);
+
+    config.fan_networkId = options.networkId;
+    config.fan_my_device_type = esphome::zehnder::FAN_TYPE_REMOTE_CONTROL;
+    config.fan_my_device_id = options.remoteId;
+    config.fan_main_unit_type = esphome::zehnder::FAN_TYPE_MAIN_UNIT;
+    config.fan_main_unit_id = options.mainUnitId;
+    (void) pref.save(&config);
+  }
+
+  this->fan.set_name("sim");
+  this->fan.set_rf(&this->rf);
+  this->fan.set_update_interval(options.interval);
+  this->fan.set_max_update_interval(options.maxInterval);
+  this->fan.set_command_timeout(options.commandTimeout);
+  this->fan.set_idle_mode(options.idleMode);
+  this->fan.set_capture_size(options.captureSize);
+  this->add(&this->fan);
+}
+
+bool FanSimulation::setSpeed(const uint8_t speed, const uint8_t timer, const uint32_t timeoutMs) {
+  const uint32_t confirmed = this->fan.setSpeedLatency_.getCount();
+
+  this->fan.setSpeed(speed, timer);
+  return this->runUntil([&]() { return this->fan.setSpeedLatency_.getCount() > confirmed; }, timeoutMs) &&
+         (this->mainUnit.getSpeed() == speed);
+}
+
+}  // namespace sim
@@ -0,0 +1,169 @@
+#pragma once
+
+// Wires the nRF905 driver to the register model on the simulated air and runs the ESPHome main loop on the
+// virtual clock, skipping ahead to the next loop, frame or pin event.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "air.h"
+#include "host.h"
+#include "main_unit.h"
+#include "nrf905_model.h"
+#include "esphome/core/component.h"
+#include "esphome/components/nrf905/nRF905.h"
+#include "esphome/components/zehnder/zehnder.h"
+
+namespace sim {
+
+#define SIM_LOOP_INTERVAL 16000000  // Main loop period without HighFrequencyLoopRequester (in ns)
+#define SIM_LOOP_FAST 200000        // Main loop period with HighFrequencyLoopRequester (in ns)
+#define SIM_START_TIME 1000000000   // Virtual clock at construction, clear of the zero special cases (in ns)
+
+// Protected driver state for the tests
+class RadioProbe : public esphome::nrf905::nRF905 {
+ public:
+  using nRF905::_registers;
+  using nRF905::_status;
+  using nRF905::_trace;
+  using nRF905::_traceCount;
+  using nRF905::_traceNext;
+  using nRF905::_traceSize;
+  using nRF905::_txAddress;
+  using nRF905::taskRunning;
+  using nRF905::txState;
+};
+
+// Protected protocol state for the tests
+class FanProbe : public esphome::zehnder::ZehnderRF {
+ public:
+  using ZehnderRF::Config;
+  using ZehnderRF::State;
+  using ZehnderRF::StateIdle;
+  using ZehnderRF::StateNrOf;
+  using ZehnderRF::StateWaitQueryResponse;
+  using ZehnderRF::StateWaitSetSpeedResponse;
+  using ZehnderRF::SavedState;
+  using ZehnderRF::RfState;
+  using ZehnderRF::RfStateIdle;
+  using ZehnderRF::RfStateRxWait;
+  using ZehnderRF::RfStateTxBusy;
+  using ZehnderRF::RfStateWaitAirwayFree;
+  using ZehnderRF::RttQuery;
+
+  using ZehnderRF::_txFrame;
+  using ZehnderRF::airwayCheckTime_;
+  using ZehnderRF::airwayLatency_;
+  using ZehnderRF::airwayTimeouts_;
+  using ZehnderRF::backoffExponent_;
+  using ZehnderRF::commandCount_;
+  using ZehnderRF::config_;
+  using ZehnderRF::configValid;
+  using ZehnderRF::confirmed_;
+  using ZehnderRF::confirmedSpeed_;
+  using ZehnderRF::duplicateFrames_;
+  using ZehnderRF::failedCommands_;
+  using ZehnderRF::msgSendTime_;
+  using ZehnderRF::overheardFrames_;
+  using ZehnderRF::pairingLatency_;
+  using ZehnderRF::pollFailures_;
+  using ZehnderRF::pollInterval_;
+  using ZehnderRF::pollLatency_;
+  using ZehnderRF::requestSpeed;
+  using ZehnderRF::replyTimeout_;
+  using ZehnderRF::retries_;
+  using ZehnderRF::retryCounts_;
+  using ZehnderRF::rfComplete;
+  using ZehnderRF::rfState_;
+  using ZehnderRF::rxFrames_;
+  using ZehnderRF::rttLatency_;
+  using ZehnderRF::rttSample;
+  using ZehnderRF::rttTimeout;
+  using ZehnderRF::rtt_;
+  using ZehnderRF::rxTime_;
+  using ZehnderRF::setSpeedLatency_;
+  using ZehnderRF::state_;
+  using ZehnderRF::timeouts_;
+  using ZehnderRF::timerRunning_;
+  using ZehnderRF::transactionStartTime_;
+  using ZehnderRF::txAttempt_;
+};
+
+typedef struct {
+  bool interruptPins{false};   // DR/AM on interrupt pins, else the status byte over SPI
+  bool carrierPin{true};       // CD pin connected
+  bool radioTask{false};       // Driver runs its radio task (USE_HOST: std::thread)
+  bool autoRetransmit{true};   // AUTO_RETRAN bursts, else a CE pulse per frame
+  uint16_t traceSize{0};       // SPI trace records
+  uint32_t seed{1};            // random_uint32() and the air impairments
+  uint64_t loopPeriod{0};      // Fixed main loop period (in ns), else SIM_LOOP_INTERVAL or SIM_LOOP_FAST
+
+  // FanSimulation
+  bool paired{true};              // Pairing in the preferences at boot, else the component pairs itself
+  uint32_t networkId{0x1A2B3C4D};
+  uint8_t mainUnitId{0x42};
+  uint8_t remoteId{0x5A};         // Device ID of the component when paired
+  uint32_t interval{10000};       // update_interval (ms)
+  uint32_t maxInterval{10000};    // max_update_interval (ms)
+  uint32_t commandTimeout{30000};
+  esphome::nrf905::Mode idleMode{esphome::nrf905::Receive};
+  uint16_t captureSize{0};
+} SimulationOptions;
+
+class Simulation {
+ public:
+  explicit Simulation(const SimulationOptions &options = SimulationOptions());
+  ~Simulation();
+
+  // Components looped after the driver, in order
+  void add(esphome::Component *const pComponent) { this->components_.push_back(pComponent); }
+
+  // setup() of the driver and the added components
+  void boot(void);
+
+  // Main loop for ms of virtual time
+  void runFor(const uint32_t ms);
+
+  // Main loop until done() holds, at most timeoutMs; true when it did
+  template<typename F> bool runUntil(F done, const uint32_t timeoutMs) {
+    const uint64_t limit = esphome::host::now_ns() + (timeoutMs * 1000000ULL);
+
+    while (!done()) {
+      if (esphome::host::now_ns() >= limit) {
+        return false;
+      }
+      this->step(limit);
+    }
+    return true;
+  }
+
+  uint32_t getLoops(void) const { return this->loops_; }
+
+  SimulationOptions options;
+  Air air;
+  Nrf905Model radio{air};
+  RadioProbe rf;
+
+ protected:
+  void step(const uint64_t limit);
+  void loop(void);
+
+  std::vector<esphome::Component *> components_;
+  uint64_t nextLoop_{0};
+  uint32_t loops_{0};
+};
+
+// The bridge: driver and zehnder component, with a main unit on the air
+class FanSimulation : public Simulation {
+ public:
+  explicit FanSimulation(const SimulationOptions &options = SimulationOptions());
+
+  // Confirmed by the fan within timeoutMs
+  bool setSpeed(const uint8_t speed, const uint8_t timer, const uint32_t timeoutMs);
+
+  MainUnit mainUnit;
+  FanProbe fan;
+};
+
+}  // namespace sim
@@ -0,0 +1,78 @@
+// Heap use of the RF hot path: once running, a poll cycle must not allocate. The whole process is counted,
+// simulator included, so the count is an upper bound for the components.
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+#include "simulation.h"
+
+using namespace esphome;
+using namespace sim;
+
+static std::atomic<uint32_t> allocations{0};
+
+void *operator new(size_t size) {
+  void *const pMemory = malloc((size > 0) ? size : 1);
+
+  if (pMemory == NULL) {
+    throw std::bad_alloc();
+  }
+  ++allocations;
+  return pMemory;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *pMemory) noexcept { free(pMemory); }
+void operator delete[](void *pMemory) noexcept { free(pMemory); }
+void operator delete(void *pMemory, size_t) noexcept { free(pMemory); }
+void operator delete[](void *pMemory, size_t) noexcept { free(pMemory); }
+
+// The counter itself: boot allocates the frame capture ring
+TEST(Allocations, CounterSeesBoot) {
+  SimulationOptions options;
+
+  options.captureSize = 16;
+  FanSimulation sim(options);
+  const uint32_t before = allocations;
+
+  sim.boot();
+  EXPECT_GT(allocations - before, 0u);
+}
+
+TEST(Allocations, SteadyPollCycleAllocatesNothing) {
+  for (const bool interruptPins : {false, true}) {
+    SimulationOptions options;
+
+    options.interruptPins = interruptPins;
+    options.interval = 2000;
+    options.maxInterval = 2000;
+    FanSimulation sim(options);
+
+    sim.boot();
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+    const uint32_t before = allocations;
+    const uint32_t queries = sim.mainUnit.getQueries();
+
+    sim.runFor(10000);
+    EXPECT_GE(sim.mainUnit.getQueries(), queries + 4);
+    EXPECT_EQ(allocations - before, 0u) << "interrupt pins " << interruptPins;
+  }
+}
+
+TEST(Allocations, SetSpeedAllocatesNothing) {
+  FanSimulation sim;
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  const uint32_t before = allocations;
+
+  ASSERT_TRUE(sim.setSpeed(4, 0, 5000));
+  ASSERT_TRUE(sim.setSpeed(2, 10, 5000));
+  EXPECT_EQ(allocations - before, 0u);
+}
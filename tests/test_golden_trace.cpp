@@ -0,0 +1,156 @@
+// Golden SPI traces: a fixed simulated scenario through driver and protocol engine must put the same transactions
+// on the bus as the checked-in trace of an earlier run, record for record. Nothing recorded on hardware is fed back
+// into the driver; this is a regression test of the bus traffic. Reports bus occupancy; a change that adds SPI traffic
+// to the hot path shows up as a diff.
+//
+// After an intended change, regenerate the traces, review the diff and run again without UPDATE_TRACES; a run that
+// regenerates fails on purpose:
+//   UPDATE_TRACES=1 ctest --test-dir build -R test_golden_trace
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+using namespace esphome;
+using namespace sim;
+
+#define GOLDEN_TRACE_SIZE 2048  // Records; holds boot plus the poll cycles below
+#define GOLDEN_POLL_CYCLES 3    // Complete cycles after the one at boot
+
+typedef struct {
+  const char *name;
+  bool interruptPins;
+} Scenario;
+
+static const Scenario SCENARIOS[] = {
+    {"poll_spi_status", false},
+    {"poll_pin_status", true},
+};
+
+typedef struct {
+  uint32_t transactions;
+  uint32_t bytes;
+  uint32_t spanUs;
+  std::vector<uint32_t> cycles;  // Transactions per complete poll cycle
+} Occupancy;
+
+// Oldest record first
+static std::vector<nrf905::TraceRecord> records(const RadioProbe &rf) {
+  std::vector<nrf905::TraceRecord> result;
+  const uint16_t first = (rf._traceNext + rf._traceSize - rf._traceCount) % rf._traceSize;
+
+  for (uint16_t i = 0; i < rf._traceCount; ++i) {
+    result.push_back(rf._trace[(first + i) % rf._traceSize]);
+  }
+  return result;
+}
+
+// One line per record, without the timestamp; the order and content of the bus traffic is what must not change
+static std::string format(const std::vector<nrf905::TraceRecord> &trace) {
+  static const char *const KINDS[] = {"SPI", "MODE", "MARK"};
+  std::string text;
+  char line[32];
+
+  for (const nrf905::TraceRecord &record : trace) {
+    (void) snprintf(line, sizeof(line), "%s %02X %u %02X\n", KINDS[record.kind], record.command, record.length,
+                    record.status);
+    text += line;
+  }
+  return text;
+}
+
+static Occupancy occupancy(const std::vector<nrf905::TraceRecord> &trace) {
+  Occupancy result{0, 0, 0, {}};
+  bool inCycle = false;
+  uint32_t cycle = 0;
+
+  for (const nrf905::TraceRecord &record : trace) {
+    if ((record.kind == nrf905::TraceMark) && (record.command == zehnder::TraceMarkPoll)) {
+      if (inCycle) {
+        result.cycles.push_back(cycle);
+      }
+      inCycle = true;
+      cycle = 0;
+    } else if (record.kind == nrf905::TraceSpi) {
+      ++result.transactions;
+      result.bytes += record.length;
+      ++cycle;
+    }
+  }
+  if (trace.size() > 1) {
+    result.spanUs = trace.back().time - trace.front().time;
+  }
+  return result;
+}
+
+static void report(const char *const name, const Occupancy &bus) {
+  uint32_t cycleTotal = 0;
+
+  for (const uint32_t cycle : bus.cycles) {
+    cycleTotal += cycle;
+  }
+  printf("%-16s %u transactions, %u bytes in %.3f s: %.1f bytes/s, %.1f transactions per poll cycle\n", name,
+         bus.transactions, bus.bytes, bus.spanUs / 1e6, bus.bytes / (bus.spanUs / 1e6),
+         bus.cycles.empty() ? 0.0 : (double) cycleTotal / bus.cycles.size());
+}
+
+static std::string tracePath(const char *const name) { return std::string(TRACE_DIR) + "/" + name + ".trace"; }
+
+class GoldenTraceTest : public ::testing::TestWithParam<Scenario> {};
+
+TEST_P(GoldenTraceTest, MatchesGoldenTrace) {
+  const Scenario &scenario = GetParam();
+  SimulationOptions options;
+
+  options.interruptPins = scenario.interruptPins;
+  options.interval = 2000;
+  options.maxInterval = 2000;
+  options.traceSize = GOLDEN_TRACE_SIZE;
+  FanSimulation sim(options);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.mainUnit.getQueries() == GOLDEN_POLL_CYCLES + 2; }, 30000));
+  ASSERT_LT(sim.rf._traceCount, GOLDEN_TRACE_SIZE) << "trace wrapped";
+
+  const std::vector<nrf905::TraceRecord> trace = records(sim.rf);
+  const Occupancy bus = occupancy(trace);
+  const std::string text = format(trace);
+
+  report(scenario.name, bus);
+  EXPECT_EQ(bus.cycles.size(), GOLDEN_POLL_CYCLES + 1u);
+
+  if (getenv("UPDATE_TRACES") != NULL) {
+    std::ofstream(tracePath(scenario.name)) << text;
+    ADD_FAILURE() << "Regenerated " << tracePath(scenario.name) << "; review the diff, then run without UPDATE_TRACES";
+    return;
+  }
+
+  std::ifstream file(tracePath(scenario.name));
+  ASSERT_TRUE(file.good()) << tracePath(scenario.name) << " missing, run with UPDATE_TRACES=1";
+  std::stringstream recorded;
+  recorded << file.rdbuf();
+
+  // Point at the first record that differs
+  std::istringstream expected(recorded.str());
+  std::istringstream actual(text);
+  std::string expectedLine;
+  std::string actualLine;
+  uint32_t line = 1;
+
+  while (std::getline(expected, expectedLine) && std::getline(actual, actualLine)) {
+    ASSERT_EQ(actualLine, expectedLine) << "record " << line;
+    ++line;
+  }
+  EXPECT_EQ(text.size(), recorded.str().size()) << "trace length differs after record " << line;
+}
+
+INSTANTIATE_TEST_SUITE_P(Golden, GoldenTraceTest, ::testing::ValuesIn(SCENARIOS),
+                         [](const ::testing::TestParamInfo<Scenario> &info) { return info.param.name; });
@@ -0,0 +1,381 @@
+// nRF905 driver against the register model: config image, SPI traffic, TX bursts and RX delivery
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "simulation.h"
+
+using namespace esphome;
+using namespace sim;
+
+static const uint32_t LINK_ADDRESS = 0x89816EA9;
+
+static void onTxReady(void *const pArg) { ++*(uint32_t *) pArg; }
+
+// Frame from another radio on the channel of the driver
+static void sendFrame(Simulation &sim, const uint32_t address, const uint8_t *const pPayload) {
+  Transmission tx{};
+
+  tx.start = host::now_ns();
+  tx.end = tx.start + frameAirTime(4, 16, 16);
+  tx.channel = 118;
+  tx.band = true;
+  tx.address[0] = address & 0xFF;
+  tx.address[1] = (address >> 8) & 0xFF;
+  tx.address[2] = (address >> 16) & 0xFF;
+  tx.address[3] = (address >> 24) & 0xFF;
+  tx.addressWidth = 4;
+  (void) memcpy(tx.payload, pPayload, 16);
+  tx.length = 16;
+  (void) sim.air.transmit(tx);
+}
+
+// Setup plus the config a user of the radio applies; nRF905::setup() only reads the radio
+static void bootLinked(Simulation &sim) {
+  sim.boot();
+
+  nrf905::Config config = sim.rf.getConfig();
+
+  sim.rf.updateConfig(&config);
+  sim.rf.writeTxAddress(config.rx_address);
+}
+
+class Nrf905Test : public ::testing::TestWithParam<bool> {
+ protected:
+  Nrf905Test() : sim(options()) {}
+
+  static SimulationOptions options(void) {
+    SimulationOptions options;
+
+    options.interruptPins = GetParam();
+    return options;
+  }
+
+  Simulation sim;
+};
+
+TEST_P(Nrf905Test, SetupOnlyReads) {
+  static const uint8_t RESET_IMAGE[NRF905_REGISTER_COUNT] = {0x6C, 0x00, 0x44, 0x20, 0x20,
+                                                             0xE7, 0xE7, 0xE7, 0xE7, 0xE7};
+
+  sim.boot();
+
+  EXPECT_EQ(sim.radio.counters().commands[SpiWConfig], 0u);
+  EXPECT_EQ(sim.radio.counters().commands[SpiWTxAddress], 0u);
+  EXPECT_EQ(memcmp(sim.radio.registers(), RESET_IMAGE, NRF905_REGISTER_COUNT), 0);
+  EXPECT_EQ(memcmp(sim.rf._registers, RESET_IMAGE, NRF905_REGISTER_COUNT), 0);
+
+  // Defaults for the user of the radio to start from
+  const nrf905::Config config = sim.rf.getConfig();
+
+  EXPECT_EQ(config.channel, 118);
+  EXPECT_EQ(config.rx_address, LINK_ADDRESS);
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Idle);
+}
+
+TEST_P(Nrf905Test, DefaultConfigImage) {
+  bootLinked(sim);
+
+  EXPECT_EQ(sim.radio.channel(), 118);
+  EXPECT_TRUE(sim.radio.band());
+  EXPECT_EQ(sim.radio.rxAddress(), LINK_ADDRESS);
+  EXPECT_EQ(sim.radio.txAddress(), LINK_ADDRESS);
+  EXPECT_EQ(sim.radio.registers()[3], 16);  // RX payload width
+  EXPECT_EQ(sim.radio.registers()[4], 16);  // TX payload width
+  EXPECT_EQ(sim.radio.registers()[9] & 0xC0, 0xC0);  // CRC16
+  EXPECT_EQ(memcmp(sim.radio.registers(), sim.rf._registers, NRF905_REGISTER_COUNT), 0);
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Idle);
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+TEST_P(Nrf905Test, ConfigWritesOnlyChangedRange) {
+  bootLinked(sim);
+  sim.radio.resetCounters();
+
+  nrf905::Config config = sim.rf.getConfig();
+
+  config.rx_address = 0x12345678;
+  sim.rf.updateConfig(&config);
+  EXPECT_EQ(sim.radio.rxAddress(), 0x12345678u);
+  EXPECT_EQ(sim.radio.counters().commands[SpiWConfig], 1u);
+
+  // Unchanged image, nothing on the bus
+  sim.radio.resetCounters();
+  sim.rf.updateConfig(&config);
+  sim.rf.setChannelConfig(118, true, 10);
+  EXPECT_EQ(sim.radio.counters().transactions, 0u);
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+TEST_P(Nrf905Test, AutoRetransmitBurst) {
+  uint8_t payload[16];
+  uint32_t ready = 0;
+
+  bootLinked(sim);
+  sim.rf.setOnTxReady(onTxReady, &ready);
+  for (uint8_t i = 0; i < sizeof(payload); ++i) {
+    payload[i] = i;
+  }
+
+  sim.rf.writeTxAddress(0xE7E7E7E7);
+  sim.rf.writeTxPayload(payload, sizeof(payload));
+  sim.rf.startTx(4, nrf905::Receive);
+  ASSERT_TRUE(sim.runUntil([&]() { return ready > 0; }, 1000));
+
+  EXPECT_EQ(ready, 1u);
+  EXPECT_EQ(sim.radio.counters().framesSent, 4u);
+  EXPECT_EQ(sim.radio.counters().framesCut, 0u);
+  EXPECT_EQ(memcmp(sim.radio.txPayload(), payload, sizeof(payload)), 0);
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Receive);
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+TEST_P(Nrf905Test, ReceivesMatchingFrames) {
+  uint8_t payload[16];
+
+  bootLinked(sim);
+  sim.rf.setMode(nrf905::Receive);
+  sim.runFor(5);
+
+  for (uint8_t i = 0; i < sizeof(payload); ++i) {
+    payload[i] = 0xA0 + i;
+  }
+  sendFrame(sim, LINK_ADDRESS, payload);
+  sim.runFor(50);
+
+  const nrf905::RxFrame *const pFrame = sim.rf.peekRxFrame();
+
+  ASSERT_NE(pFrame, nullptr);
+  EXPECT_EQ(pFrame->length, 16);
+  EXPECT_EQ(memcmp(pFrame->payload, payload, sizeof(payload)), 0);
+  sim.rf.releaseRxFrame();
+
+  // Other network; no address match, nothing read
+  sendFrame(sim, 0x11223344, payload);
+  sim.runFor(50);
+  EXPECT_EQ(sim.rf.peekRxFrame(), nullptr);
+  EXPECT_EQ(sim.radio.counters().framesReceived, 1u);
+  EXPECT_EQ(sim.radio.counters().commands[SpiRRxPayload], 1u);
+  EXPECT_EQ(sim.rf.getRxStats().frames, 1u);
+}
+
+// Frames keep coming while nobody drains the queue: the newest are dropped and counted, the queued ones keep order
+TEST_P(Nrf905Test, CountsRxQueueOverflows) {
+  uint8_t payload[16] = {0};
+  const nrf905::RxFrame *pFrame;
+  uint8_t next = 0;
+
+  bootLinked(sim);
+  sim.rf.setMode(nrf905::Receive);
+  sim.runFor(5);
+
+  for (uint8_t i = 0; i < RX_QUEUE_SIZE + 2; ++i) {
+    payload[0] = i;
+    sendFrame(sim, LINK_ADDRESS, payload);
+    sim.runFor(20);
+  }
+  EXPECT_EQ(sim.radio.counters().framesReceived, RX_QUEUE_SIZE + 2u);
+  EXPECT_EQ(sim.rf.getRxStats().frames, RX_QUEUE_SIZE - 1u);
+  EXPECT_EQ(sim.rf.getRxStats().overflows, 3u);
+
+  while ((pFrame = sim.rf.peekRxFrame()) != NULL) {
+    EXPECT_EQ(pFrame->payload[0], next++);
+    sim.rf.releaseRxFrame();
+  }
+  EXPECT_EQ(next, RX_QUEUE_SIZE - 1);
+
+  // Room again
+  payload[0] = 0xFF;
+  sendFrame(sim, LINK_ADDRESS, payload);
+  sim.runFor(20);
+  ASSERT_NE(pFrame = sim.rf.peekRxFrame(), nullptr);
+  EXPECT_EQ(pFrame->payload[0], 0xFF);
+  EXPECT_EQ(sim.rf.getRxStats().overflows, 3u);
+}
+
+TEST_P(Nrf905Test, SpiStatsMatchBus) {
+  uint8_t payload[16] = {0};
+
+  bootLinked(sim);
+  sim.rf.resetSpiStats();
+  sim.radio.resetCounters();
+
+  sim.rf.writeTxPayload(payload, sizeof(payload));
+  sim.rf.startTx(4, nrf905::Receive);
+  sim.runFor(200);
+  sendFrame(sim, LINK_ADDRESS, payload);
+  sim.runFor(200);
+
+  EXPECT_EQ(sim.rf.getSpiStats().transactions, sim.radio.counters().transactions);
+  EXPECT_EQ(sim.rf.getSpiStats().bytes, sim.radio.counters().bytes);
+  EXPECT_GT(sim.radio.counters().transactions, 0u);
+}
+
+TEST_P(Nrf905Test, TxTimeout) {
+  uint8_t payload[16] = {0};
+  uint32_t ready = 0;
+
+  bootLinked(sim);
+  sim.rf.setOnTxReady(onTxReady, &ready);
+  sim.radio.setTxFault(true);
+
+  sim.rf.writeTxPayload(payload, sizeof(payload));
+  sim.rf.startTx(4, nrf905::Receive);
+  EXPECT_TRUE(HighFrequencyLoopRequester::is_high_frequency());
+  sim.runFor(MAX_TRANSMIT_TIME - 100);
+  EXPECT_EQ(ready, 0u);
+
+  ASSERT_TRUE(sim.runUntil([&]() { return ready > 0; }, 500));
+  EXPECT_EQ(sim.rf.txState, nrf905::TxIdle);
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Receive);
+  EXPECT_FALSE(HighFrequencyLoopRequester::is_high_frequency());
+}
+
+// TRX_CE pulse per frame; the main loop doesn't see DR drop in between
+TEST_P(Nrf905Test, PulsedBurst) {
+  SimulationOptions pulsed = options();
+  uint8_t payload[16] = {0};
+  uint32_t ready = 0;
+
+  pulsed.autoRetransmit = false;
+  Simulation sim(pulsed);
+
+  bootLinked(sim);
+  sim.rf.setOnTxReady(onTxReady, &ready);
+  sim.rf.writeTxPayload(payload, sizeof(payload));
+  for (uint8_t burst = 1; burst <= 3; ++burst) {
+    sim.rf.startTx(4, nrf905::Receive);
+    ASSERT_TRUE(sim.runUntil([&]() { return ready == burst; }, 1000)) << "burst " << (int) burst;
+    EXPECT_EQ(sim.radio.counters().framesSent, 4u * burst);
+  }
+  EXPECT_FALSE(sim.radio.autoRetransmit());
+  EXPECT_EQ(sim.radio.counters().framesCut, 0u);
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+// A main loop slower than a frame on air sees DR late; bursts may run long, but no frame is cut short
+TEST_P(Nrf905Test, SlowLoopCompletesFrames) {
+  for (const bool autoRetransmit : {true, false}) {
+    SimulationOptions slow = options();
+    uint8_t payload[16] = {0};
+    uint32_t ready = 0;
+
+    slow.autoRetransmit = autoRetransmit;
+    slow.loopPeriod = 3 * frameAirTime(4, sizeof(payload), 16);
+    Simulation sim(slow);
+
+    bootLinked(sim);
+    sim.rf.setOnTxReady(onTxReady, &ready);
+    sim.rf.writeTxPayload(payload, sizeof(payload));
+    sim.rf.startTx(4, nrf905::Receive);
+    ASSERT_TRUE(sim.runUntil([&]() { return ready > 0; }, 1000)) << "auto retransmit " << autoRetransmit;
+
+    EXPECT_GE(sim.radio.counters().framesSent, 4u) << "auto retransmit " << autoRetransmit;
+    if (autoRetransmit == false) {
+      EXPECT_EQ(sim.radio.counters().framesSent, 4u);
+    }
+    EXPECT_EQ(sim.radio.counters().framesCut, 0u) << "auto retransmit " << autoRetransmit;
+    EXPECT_EQ(sim.radio.counters().violations, 0u) << "auto retransmit " << autoRetransmit;
+    EXPECT_EQ(sim.rf.getMode(), nrf905::Receive);
+    EXPECT_FALSE(sim.radio.transmitting());
+  }
+}
+
+TEST(Nrf905Status, WriteInReceiveSavesStatusPoll) {
+  Simulation sim;
+
+  bootLinked(sim);
+  sim.rf.setMode(nrf905::Receive);
+  sim.runFor(5);
+  sim.radio.resetCounters();
+
+  // Standby excursion for the write; its status byte serves the next poll back in Receive
+  sim.rf.writeTxAddress(0x11223344);
+  sim.rf.loop();
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Receive);
+  EXPECT_EQ(sim.radio.counters().transactions, 1u);
+  EXPECT_EQ(sim.radio.counters().commands[SpiNop], 0u);
+
+  // Too old by now
+  host::advance_ns(2000000);
+  sim.rf.loop();
+  EXPECT_EQ(sim.radio.counters().commands[SpiNop], 1u);
+}
+
+// Radio task as a thread; main loop calls are queued to it
+TEST(Nrf905Task, RunsRadioFromThread) {
+  SimulationOptions options;
+  uint8_t payload[16] = {0};
+  uint32_t ready = 0;
+
+  options.interruptPins = true;
+  options.radioTask = true;
+  Simulation sim(options);
+
+  bootLinked(sim);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.radio.rxAddress() == LINK_ADDRESS; }, 100));
+
+  sim.rf.setOnTxReady(onTxReady, &ready);
+  sim.rf.writeTxPayload(payload, sizeof(payload));
+  sim.rf.startTx(4, nrf905::Receive);
+  ASSERT_TRUE(sim.runUntil([&]() { return ready > 0; }, 1000));
+  EXPECT_GE(sim.radio.counters().framesSent, 4u);
+
+  // Visible to the main loop right away, on the radio once the task got to it
+  sim.rf.setChannelConfig(120, true, 10);
+  EXPECT_EQ(sim.rf.getConfig().channel, 120);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.radio.channel() == 120; }, 100));
+
+  sim.rf.resetSpiStats();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.rf.getSpiStats().transactions == 0; }, 100));
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+// The main loop sees the mode it asked for and the state the task published; asking again queues nothing
+TEST(Nrf905Task, PublishesModeAndModeTime) {
+  SimulationOptions options;
+  uint32_t total = 0;
+
+  options.interruptPins = true;
+  options.radioTask = true;
+  Simulation sim(options);
+
+  bootLinked(sim);
+  const uint32_t start = millis();
+
+  sim.rf.setMode(nrf905::Receive);
+  EXPECT_EQ(sim.rf.getMode(), nrf905::Receive);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.radio.ce.level() == true; }, 100));
+
+  const uint32_t pinWrites = sim.radio.counters().pinWrites;
+  for (uint8_t i = 0; i < 100; ++i) {
+    sim.rf.setMode(nrf905::Receive);
+    sim.runFor(1);
+  }
+  EXPECT_EQ(sim.radio.counters().pinWrites, pinWrites);
+
+  sim.runFor(100);
+  for (uint8_t mode = 0; mode < nrf905::ModeNrOf; ++mode) {
+    total += sim.rf.getModeTime((nrf905::Mode) mode);
+  }
+  // As of the last task run, which runs on its own clock
+  EXPECT_GE(sim.rf.getModeTime(nrf905::Receive), 100u);
+  EXPECT_LE(total, millis() - start + 20);
+  EXPECT_GE(total + 20, millis() - start);
+}
+
+// Without DR the task would poll the status over SPI every period; the driver stays in the main loop
+TEST(Nrf905Task, NeedsDrPin) {
+  SimulationOptions options;
+
+  options.interruptPins = false;
+  options.radioTask = true;
+  Simulation sim(options);
+
+  bootLinked(sim);
+  EXPECT_FALSE(sim.rf.taskRunning());
+}
+
+INSTANTIATE_TEST_SUITE_P(Status, Nrf905Test, ::testing::Values(false, true),
+                         [](const ::testing::TestParamInfo<bool> &info) { return info.param ? "Pins" : "Spi"; });
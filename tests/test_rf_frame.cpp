@@ -0,0 +1,144 @@
+// RfFrame codec: builders byte for byte, and the decoder rejecting every malformed frame before the protocol sees it
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "esphome/components/zehnder/rf_frame.h"
+
+using namespace esphome::zehnder;
+
+static const RfRoute ROUTE = {FAN_TYPE_MAIN_UNIT, 0x42, FAN_TYPE_REMOTE_CONTROL, 0x5A};
+
+// Valid header for command with parameterCount, parameters cleared
+static void header(uint8_t *const pBuffer, const uint8_t command, const uint8_t parameterCount) {
+  (void) memset(pBuffer, 0, FAN_FRAMESIZE);
+  pBuffer[0] = FAN_TYPE_REMOTE_CONTROL;
+  pBuffer[1] = 0x5A;
+  pBuffer[2] = FAN_TYPE_MAIN_UNIT;
+  pBuffer[3] = 0x42;
+  pBuffer[4] = FAN_TTL;
+  pBuffer[5] = command;
+  pBuffer[6] = parameterCount;
+}
+
+TEST(RfFrameBuild, SetTimer) {
+  static const uint8_t EXPECTED[FAN_FRAMESIZE] = {0x01, 0x42, 0x03, 0x5A, 0xFA, 0x03, 0x02, 0x04, 0x1E};
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  (void) memset(buffer, 0xAA, sizeof(buffer));
+  rfBuildSetTimer(buffer, ROUTE, 4, 30);
+  EXPECT_EQ(memcmp(buffer, EXPECTED, FAN_FRAMESIZE), 0);
+}
+
+TEST(RfFrameBuild, JoinRequestIsLittleEndian) {
+  static const uint8_t EXPECTED[FAN_FRAMESIZE] = {0x01, 0x42, 0x03, 0x5A, 0xFA, 0x04, 0x04, 0x4D, 0x3C, 0x2B, 0x1A};
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  rfBuildJoinRequest(buffer, ROUTE, 0x1A2B3C4D);
+  EXPECT_EQ(memcmp(buffer, EXPECTED, FAN_FRAMESIZE), 0);
+}
+
+// Every builder produces a frame its own decoder accepts, with the unused parameter bytes cleared
+TEST(RfFrameBuild, BuildersDecode) {
+  typedef struct {
+    uint8_t command;
+    uint8_t parameters;
+  } Expected;
+  uint8_t buffers[7][FAN_FRAMESIZE];
+  const Expected expected[7] = {
+      {FAN_TYPE_QUERY_DEVICE, 0},   {FAN_FRAME_SETSPEED, 1},      {FAN_FRAME_SETTIMER, 2},
+      {FAN_NETWORK_JOIN_REQUEST, 4}, {FAN_NETWORK_JOIN_ACK, 4},    {FAN_FRAME_0B, 0},
+      {FAN_FRAME_SETSPEED_REPLY, 3},
+  };
+
+  (void) memset(buffers, 0xAA, sizeof(buffers));
+  rfBuildQueryDevice(buffers[0], ROUTE);
+  rfBuildSetSpeed(buffers[1], ROUTE, 2);
+  rfBuildSetTimer(buffers[2], ROUTE, 3, 10);
+  rfBuildJoinRequest(buffers[3], ROUTE, 0x1A2B3C4D);
+  rfBuildJoinAck(buffers[4], ROUTE, 0x1A2B3C4D);
+  rfBuildLinkAck(buffers[5], ROUTE);
+  rfBuildSetSpeedReply(buffers[6], ROUTE);
+
+  for (uint8_t i = 0; i < 7; ++i) {
+    const RfFrame *const pFrame = rfFrameDecode(buffers[i], FAN_FRAMESIZE);
+
+    ASSERT_NE(pFrame, nullptr) << "builder " << (int) i;
+    EXPECT_EQ(pFrame->command, expected[i].command);
+    EXPECT_EQ(pFrame->parameter_count, expected[i].parameters);
+    EXPECT_EQ(pFrame->ttl, FAN_TTL);
+    EXPECT_EQ(pFrame->rx_id, 0x42);
+    EXPECT_EQ(pFrame->tx_id, 0x5A);
+    for (uint8_t p = expected[i].parameters; p < FAN_PARAMETERS_MAX; ++p) {
+      EXPECT_EQ(pFrame->payload.parameters[p], 0x00) << "builder " << (int) i << " parameter " << (int) p;
+    }
+  }
+}
+
+TEST(RfFrameDecode, RejectsShortFrames) {
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  header(buffer, FAN_TYPE_QUERY_DEVICE, 0);
+  EXPECT_EQ(rfFrameDecode(NULL, FAN_FRAMESIZE), nullptr);
+  for (uint8_t length = 0; length < FAN_FRAMESIZE; ++length) {
+    EXPECT_EQ(rfFrameDecode(buffer, length), nullptr) << "length " << (int) length;
+  }
+  EXPECT_NE(rfFrameDecode(buffer, FAN_FRAMESIZE), nullptr);
+  EXPECT_NE(rfFrameDecode(buffer, 32), nullptr);  // Longer payload width, frame at the start
+}
+
+TEST(RfFrameDecode, RejectsParameterCountOverNine) {
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  header(buffer, FAN_TYPE_QUERY_DEVICE, FAN_PARAMETERS_MAX);
+  EXPECT_NE(rfFrameDecode(buffer, FAN_FRAMESIZE), nullptr);
+  for (uint16_t count = FAN_PARAMETERS_MAX + 1; count <= 0xFF; ++count) {
+    buffer[6] = count;
+    EXPECT_EQ(rfFrameDecode(buffer, FAN_FRAMESIZE), nullptr) << "parameter_count " << count;
+  }
+}
+
+// A command whose payload is read needs at least that many parameters; one fewer is malformed
+TEST(RfFrameDecode, MinimumParametersPerCommand) {
+  typedef struct {
+    uint8_t command;
+    uint8_t minimum;
+  } Minimum;
+  static const Minimum MINIMUMS[] = {
+      {FAN_FRAME_SETVOLTAGE, 1},     {FAN_FRAME_SETSPEED, 1},       {FAN_FRAME_SETTIMER, 2},
+      {FAN_NETWORK_JOIN_REQUEST, 4}, {FAN_FRAME_SETSPEED_REPLY, 0}, {FAN_NETWORK_JOIN_OPEN, 4},
+      {FAN_TYPE_FAN_SETTINGS, 3},    {FAN_FRAME_0B, 0},             {FAN_NETWORK_JOIN_ACK, 4},
+      {FAN_TYPE_QUERY_NETWORK, 0},   {FAN_TYPE_QUERY_DEVICE, 0},    {FAN_FRAME_SETVOLTAGE_REPLY, 0},
+  };
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  for (const Minimum &minimum : MINIMUMS) {
+    EXPECT_EQ(rfMinParameters(minimum.command), minimum.minimum) << "command " << (int) minimum.command;
+
+    header(buffer, minimum.command, minimum.minimum);
+    EXPECT_NE(rfFrameDecode(buffer, FAN_FRAMESIZE), nullptr) << "command " << (int) minimum.command;
+    if (minimum.minimum > 0) {
+      header(buffer, minimum.command, minimum.minimum - 1);
+      EXPECT_EQ(rfFrameDecode(buffer, FAN_FRAMESIZE), nullptr) << "command " << (int) minimum.command;
+    }
+  }
+
+  // Unknown commands carry nothing the protocol reads
+  EXPECT_EQ(rfMinParameters(0xEE), 0);
+}
+
+TEST(RfFrameDecode, IsZeroCopy) {
+  uint8_t buffer[FAN_FRAMESIZE];
+
+  header(buffer, FAN_TYPE_FAN_SETTINGS, 3);
+  buffer[7] = 2;
+  buffer[8] = 50;
+  buffer[9] = 0;
+
+  const RfFrame *const pFrame = rfFrameDecode(buffer, FAN_FRAMESIZE);
+
+  ASSERT_EQ((const void *) pFrame, (const void *) buffer);
+  EXPECT_EQ(pFrame->payload.fanSettings.speed, 2);
+  EXPECT_EQ(pFrame->payload.fanSettings.voltage, 50);
+}
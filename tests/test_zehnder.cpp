@@ -0,0 +1,621 @@
+// zehnder component end to end: driver, radio model and a simulated main unit on the air
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <vector>
+
+#include "simulation.h"
+
+using namespace esphome;
+using namespace sim;
+
+TEST(Zehnder, PairsWithMainUnit) {
+  SimulationOptions options;
+
+  options.paired = false;
+  FanSimulation sim(options);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pairingLatency_.getCount() > 0; }, 60000));
+
+  EXPECT_EQ(sim.fan.config_.fan_networkId, options.networkId);
+  EXPECT_EQ(sim.fan.config_.fan_main_unit_id, options.mainUnitId);
+  EXPECT_TRUE(sim.mainUnit.isLinked(sim.fan.config_.fan_my_device_id));
+  EXPECT_EQ(sim.radio.rxAddress(), options.networkId);
+  EXPECT_EQ(sim.radio.txAddress(), options.networkId);
+}
+
+TEST(Zehnder, PollsFanSettings) {
+  FanSimulation sim;
+
+  sim.mainUnit.setSpeed(3);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  EXPECT_EQ(sim.fan.speed, 3);
+  EXPECT_TRUE(sim.fan.state);
+  EXPECT_EQ(sim.mainUnit.getQueries(), 1u);
+
+  // Next poll after update_interval
+  sim.runFor(10500);
+  EXPECT_EQ(sim.mainUnit.getQueries(), 2u);
+  EXPECT_EQ(sim.radio.counters().violations, 0u);
+}
+
+TEST(Zehnder, SetSpeedIsConfirmed) {
+  FanSimulation sim;
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  ASSERT_TRUE(sim.setSpeed(4, 0, 5000));
+  EXPECT_EQ(sim.fan.speed, 4);
+  EXPECT_EQ(sim.mainUnit.getSetSpeeds(), 1u);
+
+  // Settings reply goes out once, without waiting for an answer
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.mainUnit.getSetSpeedReplies() > 0; }, 1000));
+  ASSERT_TRUE(sim.setSpeed(2, 10, 5000));
+  EXPECT_EQ(sim.mainUnit.getTimer(host::now_ns()), 10);
+}
+
+TEST(Zehnder, RetriesThroughFrameLoss) {
+  SimulationOptions options;
+
+  options.seed = 7;
+  FanSimulation sim(options);
+
+  sim.air.setLoss(0.3);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 30000));
+  for (uint8_t speed = 1; speed <= 4; ++speed) {
+    EXPECT_TRUE(sim.setSpeed(speed, 0, 30000)) << "speed " << (int) speed;
+  }
+  EXPECT_GT(sim.air.getLost(), 0u);
+}
+
+// Reply timeout: fixed until measured, then srtt + 4 * rttvar, doubling per retry up to FAN_REPLY_TIMEOUT_MAX
+TEST(Zehnder, ReplyTimeoutFromMeasuredRtt) {
+  FanSimulation sim;
+
+  ((zehnder::RfFrame *) sim.fan._txFrame)->command = zehnder::FAN_TYPE_QUERY_DEVICE;
+  for (sim.fan.txAttempt_ = 0; sim.fan.txAttempt_ <= FAN_TX_RETRIES; ++sim.fan.txAttempt_) {
+    EXPECT_EQ(sim.fan.rttTimeout(), (uint32_t) FAN_REPLY_TIMEOUT) << "attempt " << (int) sim.fan.txAttempt_;
+  }
+
+  sim.fan.txAttempt_ = 0;
+  sim.fan.rttSample(100);
+  EXPECT_EQ(sim.fan.rtt_[FanProbe::RttQuery].srtt, 100u);
+  EXPECT_EQ(sim.fan.rtt_[FanProbe::RttQuery].rttvar, 50u);
+  EXPECT_EQ(sim.fan.rttTimeout(), 300u);
+
+  const uint32_t backoff[] = {300, 600, 1200, 2400, FAN_REPLY_TIMEOUT_MAX, FAN_REPLY_TIMEOUT_MAX};
+  for (sim.fan.txAttempt_ = 0; sim.fan.txAttempt_ < 6; ++sim.fan.txAttempt_) {
+    EXPECT_EQ(sim.fan.rttTimeout(), backoff[sim.fan.txAttempt_]) << "attempt " << (int) sim.fan.txAttempt_;
+  }
+
+  sim.fan.txAttempt_ = 0;
+  sim.fan.rttSample(200);
+  EXPECT_EQ(sim.fan.rtt_[FanProbe::RttQuery].srtt, 112u);
+  EXPECT_EQ(sim.fan.rtt_[FanProbe::RttQuery].rttvar, 62u);
+  EXPECT_EQ(sim.fan.rttTimeout(), 360u);
+}
+
+// A reply to a retried frame may answer any of the attempts; only first attempts feed the estimate (Karn)
+TEST(Zehnder, RetriedReplyIsNoRttSample) {
+  FanSimulation sim;
+
+  ((zehnder::RfFrame *) sim.fan._txFrame)->command = zehnder::FAN_TYPE_QUERY_DEVICE;
+  sim.fan.rfState_ = FanProbe::RfStateRxWait;
+  sim.fan.retries_ = FAN_TX_RETRIES - 1;
+  sim.fan.txAttempt_ = 1;
+  sim.fan.msgSendTime_ = 1000;
+  sim.fan.rxTime_ = 1080;
+  sim.fan.rfComplete();
+  EXPECT_FALSE(sim.fan.rtt_[FanProbe::RttQuery].valid);
+  EXPECT_EQ(sim.fan.rttLatency_.getCount(), 1u);
+  EXPECT_EQ(sim.fan.retryCounts_[1], 1u);
+
+  sim.fan.rfState_ = FanProbe::RfStateRxWait;
+  sim.fan.retries_ = FAN_TX_RETRIES;
+  sim.fan.txAttempt_ = 0;
+  sim.fan.rfComplete();
+  EXPECT_TRUE(sim.fan.rtt_[FanProbe::RttQuery].valid);
+  EXPECT_EQ(sim.fan.rtt_[FanProbe::RttQuery].srtt, 80u);
+}
+
+// Retries back off, but a transaction still gives up within FAN_TRANSACTION_TIMEOUT
+TEST(Zehnder, GivesUpWithinTransactionTimeout) {
+  for (const bool measured : {false, true}) {
+    FanSimulation sim;
+
+    sim.boot();
+    if (measured) {
+      ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+      ASSERT_TRUE(sim.fan.rtt_[FanProbe::RttQuery].valid);
+    }
+    sim.air.setLoss(1.0);
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.rfState_ == FanProbe::RfStateWaitAirwayFree; }, 20000));
+    const uint32_t start = sim.fan.transactionStartTime_;
+
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.retryCounts_[FAN_TX_RETRIES + 1] > 0; }, 60000));
+    const uint32_t elapsed = millis() - start;
+    EXPECT_GE(elapsed, (uint32_t) FAN_TRANSACTION_TIMEOUT) << "measured " << measured;
+    EXPECT_LE(elapsed, (uint32_t) FAN_TRANSACTION_TIMEOUT + 100) << "measured " << measured;
+  }
+
+  // Without a measured round trip that is every retry at the fixed timeout, as before backoff
+  FanSimulation sim;
+
+  sim.air.setLoss(1.0);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.retryCounts_[FAN_TX_RETRIES + 1] > 0; }, 20000));
+  EXPECT_EQ(sim.radio.counters().framesSent, (uint32_t) (FAN_TX_RETRIES + 1) * FAN_TX_FRAMES);
+}
+
+// An unreachable fan is polled less and less often, up to max_update_interval; one answer resets that
+TEST(Zehnder, PollBacksOffWhileUnreachable) {
+  SimulationOptions options;
+  const uint32_t intervals[] = {20000, 40000, 60000, 60000};
+  uint32_t start;
+
+  options.interval = 10000;
+  options.maxInterval = 60000;
+  FanSimulation sim(options);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+  sim.air.setLoss(1.0);
+
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pollFailures_ == 1; }, 30000));
+  start = sim.fan.transactionStartTime_;
+  for (uint8_t failures = 1; failures <= 4; ++failures) {
+    EXPECT_EQ(sim.fan.pollInterval_, intervals[failures - 1]) << "failures " << (int) failures;
+
+    // Next poll pollInterval_ after the previous one went out
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.transactionStartTime_ != start; }, 70000));
+    EXPECT_GE(sim.fan.transactionStartTime_ - start, intervals[failures - 1]);
+    EXPECT_LE(sim.fan.transactionStartTime_ - start, intervals[failures - 1] + 100);
+    start = sim.fan.transactionStartTime_;
+    if (failures < 4) {
+      ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pollFailures_ == failures + 1; }, 30000));
+    }
+  }
+
+  sim.air.setLoss(0.0);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pollFailures_ == 0; }, 30000));
+  EXPECT_EQ(sim.fan.pollInterval_, options.interval);
+  EXPECT_FALSE(sim.fan.is_state_stale());
+}
+
+// With a timer running the fan is polled shortly after it runs out, not a whole update_interval later
+TEST(Zehnder, PollsWhenTimerRunsOut) {
+  SimulationOptions options;
+
+  options.interval = 300000;
+  options.maxInterval = 300000;
+  FanSimulation sim(options);
+
+  sim.mainUnit.setSpeed(1);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  ASSERT_TRUE(sim.setSpeed(4, 1, 5000));
+  const uint32_t set = millis();
+  const uint32_t queries = sim.mainUnit.getQueries();
+
+  // After the quick check of the change the next poll waits for the timer
+  EXPECT_TRUE(sim.fan.timerRunning_);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.mainUnit.getQueries() == queries + 1; }, FAN_POLL_FAST + 1000));
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.mainUnit.getQueries() == queries + 2; }, 120000));
+  EXPECT_GE(millis() - set, 60000u);
+  EXPECT_LE(millis() - set, 60000u + FAN_POLL_TIMER_MARGIN + 100);
+
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.speed == 1; }, 2000));
+  EXPECT_FALSE(sim.fan.timerRunning_);
+}
+
+// Frames between the main unit and another remote are picked up one after the other
+TEST(Zehnder, FollowsOtherRemotes) {
+  for (const bool interruptPins : {false, true}) {
+    SimulationOptions options;
+
+    options.interruptPins = interruptPins;
+    FanSimulation sim(options);
+    Remote remote(sim.air, options.networkId, 0x77);
+
+    sim.boot();
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+    remote.sendSetSpeed(host::now_ns() + 1000000, 4);
+    ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.speed == 4; }, 2000)) << "interrupt pins " << interruptPins;
+    EXPECT_GT(sim.fan.overheardFrames_, 0u);
+    EXPECT_EQ(sim.mainUnit.getSpeed(), 4);
+  }
+}
+
+TEST(Zehnder, PollReplyDoesNotConfirmSetSpeed) {
+  FanSimulation sim;
+
+  sim.mainUnit.setReplyDelay(150000, 200000);
+  sim.boot();
+
+  // Poll on air, its reply still to come
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.rfState_ == FanProbe::RfStateRxWait; }, 1000));
+  ASSERT_EQ(sim.fan.state_, FanProbe::StateWaitQueryResponse);
+
+  ASSERT_TRUE(sim.setSpeed(4, 0, 5000));
+  EXPECT_EQ(sim.fan.speed, 4);
+  EXPECT_EQ(sim.fan.confirmedSpeed_, 4);
+}
+
+// Requests while a poll is in flight coalesce into one queue entry per command type; the last one wins
+TEST(Zehnder, QueuedSetSpeedsCoalesce) {
+  FanSimulation sim;
+
+  sim.mainUnit.setReplyDelay(150000, 200000);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.rfState_ == FanProbe::RfStateRxWait; }, 1000));
+
+  for (uint8_t speed = 1; speed <= 4; ++speed) {
+    sim.fan.setSpeed(speed, 0);
+  }
+  EXPECT_EQ(sim.fan.commandCount_, 1);
+
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.setSpeedLatency_.getCount() > 0; }, 5000));
+  EXPECT_EQ(sim.mainUnit.getSpeed(), 4);
+  EXPECT_EQ(sim.mainUnit.getSetSpeeds(), 1u);
+}
+
+// A reply heard again within FAN_DUPLICATE_WINDOW is a retransmission: counted, not handled a second time
+TEST(Zehnder, RepeatedReplyIsDuplicate) {
+  SimulationOptions options;
+  zehnder::CaptureRecord record{};
+
+  options.captureSize = 8;
+  options.interval = 60000;
+  options.maxInterval = 60000;
+  FanSimulation sim(options);
+  Station echo(sim.air);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+  const uint32_t duplicates = sim.fan.duplicateFrames_;
+
+  std::vector<uint8_t> image(sim.fan.captureImageSize());
+  const size_t records = sim.fan.readCapture(image.data(), image.size()) / sizeof(record);
+  bool found = false;
+
+  for (size_t i = 0; (i < records) && (found == false); ++i) {
+    (void) memcpy(&record, &image[FAN_CAPTURE_HEADER + (i * sizeof(record))], sizeof(record));
+    found = (record.direction == zehnder::CaptureRx) && (record.frame[5] == zehnder::FAN_TYPE_FAN_SETTINGS);
+  }
+  ASSERT_TRUE(found);
+
+  echo.send(host::now_ns() + 50000000, options.networkId, record.frame, 1);
+  sim.runFor(100);
+  EXPECT_EQ(sim.fan.duplicateFrames_, duplicates + 1);
+  EXPECT_EQ(sim.fan.rxFrames_[zehnder::FAN_TYPE_FAN_SETTINGS], 1u);
+
+  // Once the window has passed the same frame is news again
+  echo.send(host::now_ns() + 500000000, options.networkId, record.frame, 1);
+  sim.runFor(600);
+  EXPECT_EQ(sim.fan.duplicateFrames_, duplicates + 1);
+  EXPECT_EQ(sim.fan.rxFrames_[zehnder::FAN_TYPE_FAN_SETTINGS], 2u);
+}
+
+// Copies of the last reply still on air while the next request waits for the airway don't mask its answer
+TEST(Zehnder, LateCopiesDontMaskNextReply) {
+  SimulationOptions options;
+  zehnder::CaptureRecord record{};
+
+  options.captureSize = 8;
+  FanSimulation sim(options);
+  Station echo(sim.air);
+
+  sim.mainUnit.setSpeed(3);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  std::vector<uint8_t> image(sim.fan.captureImageSize());
+  const size_t records = sim.fan.readCapture(image.data(), image.size()) / sizeof(record);
+  bool found = false;
+
+  for (size_t i = 0; (i < records) && (found == false); ++i) {
+    (void) memcpy(&record, &image[FAN_CAPTURE_HEADER + (i * sizeof(record))], sizeof(record));
+    found = (record.direction == zehnder::CaptureRx) && (record.frame[5] == zehnder::FAN_TYPE_FAN_SETTINGS);
+  }
+  ASSERT_TRUE(found);
+
+  // Same speed again: the fan answers with the same settings frame
+  echo.send(host::now_ns(), options.networkId, record.frame, 4);
+  ASSERT_TRUE(sim.setSpeed(3, 0, FAN_REPLY_TIMEOUT - 100));
+  EXPECT_EQ(sim.fan.retryCounts_[0], 2u);
+}
+
+// The answer to a set speed to the current speed is the poll reply again, byte for byte
+TEST(Zehnder, SameSettingsAfterPollAreNoDuplicate) {
+  FanSimulation sim;
+
+  sim.mainUnit.setSpeed(3);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  ASSERT_TRUE(sim.setSpeed(3, 0, 300));
+  EXPECT_EQ(sim.fan.confirmedSpeed_, 3);
+}
+
+// Overheard state pushes the next poll back, but a poll in flight is still measured from when it was sent
+TEST(Zehnder, OverheardFrameKeepsPollLatency) {
+  FanSimulation sim;
+  Remote remote(sim.air, SimulationOptions().networkId, 0x77);
+
+  sim.mainUnit.setReplyDelay(150000, 200000);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.rfState_ == FanProbe::RfStateRxWait; }, 1000));
+
+  remote.sendSetSpeed(host::now_ns() + 10000000, 2);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pollLatency_.getCount() > 0; }, 2000));
+  EXPECT_GT(sim.fan.overheardFrames_, 0u);
+  EXPECT_GE(sim.fan.pollLatency_.getMax(), 150u);
+}
+
+// A guaranteed set speed fails at its deadline, also when its own retries would go on for longer
+TEST(Zehnder, GuaranteedSetSpeedFailsInTime) {
+  SimulationOptions options;
+
+  options.commandTimeout = 2000;
+  FanSimulation sim(options);
+
+  sim.mainUnit.setSpeed(3);
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  sim.air.setLoss(1.0);
+  sim.fan.requestSpeed(4, 0, true);
+  sim.runFor(options.commandTimeout - 100);
+  EXPECT_EQ(sim.fan.state_, FanProbe::StateWaitSetSpeedResponse);
+
+  sim.runFor(200);
+  EXPECT_EQ(sim.fan.state_, FanProbe::StateIdle);
+  EXPECT_EQ(sim.fan.speed, 3);
+  EXPECT_EQ(sim.fan.failedCommands_, 1u);
+}
+
+// Without a state confirmed by the fan a failed command can't be reverted; it shows off and stale instead
+TEST(Zehnder, ControlFailsBeforeFirstPoll) {
+  SimulationOptions options;
+
+  options.commandTimeout = 2000;
+  FanSimulation sim(options);
+
+  sim.air.setLoss(1.0);
+  sim.boot();
+  sim.fan.make_call().set_state(true).set_speed(4).perform();
+  EXPECT_EQ(sim.fan.speed, 4);
+  EXPECT_FALSE(sim.fan.is_state_stale());
+
+  sim.runFor(options.commandTimeout + 100);
+  EXPECT_FALSE(sim.fan.confirmed_);
+  EXPECT_EQ(sim.fan.failedCommands_, 1u);
+  EXPECT_FALSE(sim.fan.state);
+  EXPECT_EQ(sim.fan.speed, 0);
+  EXPECT_TRUE(sim.fan.is_state_stale());
+
+  // The first poll that gets through shows what the fan does
+  sim.air.setLoss(0.0);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 60000));
+  EXPECT_EQ(sim.fan.speed, sim.mainUnit.getSpeed());
+  EXPECT_FALSE(sim.fan.is_state_stale());
+}
+
+// A frame that never got on air is an airway timeout, not a transaction that ran out of retries
+TEST(Zehnder, AirwayTimeoutsCountedApart) {
+  FanSimulation sim;
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+
+  sim.air.addBusy(host::now_ns(), host::now_ns() + 30000000000ULL);
+  sim.fan.setSpeed(4);
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.airwayTimeouts_ > 0; }, FAN_AIRWAY_TIMEOUT + 1000));
+  EXPECT_EQ(sim.fan.retryCounts_[FAN_TX_RETRIES + 1], 0u);
+  for (uint8_t state = 0; state < FanProbe::StateNrOf; ++state) {
+    EXPECT_EQ(sim.fan.timeouts_[state], 0u) << "state " << (int) state;
+  }
+}
+
+// While the carrier is busy every sense backs off a random number of slots, out of a window that doubles
+TEST(Zehnder, AirwayBackoffGrowsAndRandomises) {
+  std::vector<uint32_t> delays[2];
+
+  for (uint8_t run = 0; run < 2; ++run) {
+    SimulationOptions options;
+
+    options.seed = 1 + run;
+    FanSimulation sim(options);
+    uint32_t checkTime = 0;
+    uint8_t exponent = 0;
+
+    sim.air.addBusy(host::now_ns(), host::now_ns() + 2000000000ULL);
+    sim.boot();
+    ASSERT_TRUE(sim.runUntil(
+        [&]() {
+          if ((sim.fan.rfState_ == FanProbe::RfStateWaitAirwayFree) && (sim.fan.airwayCheckTime_ != checkTime)) {
+            // Sensed in the first loop at or after the previous check time
+            const uint32_t delay = sim.fan.airwayCheckTime_ - checkTime;
+
+            if (sim.fan.backoffExponent_ > 0) {
+              EXPECT_GE(sim.fan.backoffExponent_, exponent);
+              EXPECT_LE(sim.fan.backoffExponent_, FAN_CSMA_MAX_EXPONENT);
+              exponent = sim.fan.backoffExponent_;
+              EXPECT_GE(delay, (uint32_t) FAN_CSMA_SLOT);
+              EXPECT_LE(delay, ((uint32_t) (1 << exponent) * FAN_CSMA_SLOT) + (SIM_LOOP_INTERVAL / 1000000));
+              delays[run].push_back(delay);
+            }
+            checkTime = sim.fan.airwayCheckTime_;
+          }
+          return sim.fan.airwayLatency_.getCount() > 0;
+        },
+        5000));
+
+    EXPECT_EQ(exponent, FAN_CSMA_MAX_EXPONENT);
+    EXPECT_GE(sim.fan.airwayLatency_.getMax(), 2000u);
+    EXPECT_EQ(sim.fan.airwayTimeouts_, 0u);
+  }
+
+  // Two bridges that sensed the same carrier don't come back at the same time
+  EXPECT_NE(delays[0], delays[1]);
+}
+
+// Time from each switch out of PowerDown into via to the Transmit that follows it (in us), from the SPI trace
+static std::vector<uint32_t> wakeToTransmit(const RadioProbe &rf, const nrf905::Mode via) {
+  const uint16_t first = (rf._traceNext + rf._traceSize - rf._traceCount) % rf._traceSize;
+  std::vector<uint32_t> result;
+  bool awake = false;
+  uint32_t wakeTime = 0;
+
+  for (uint16_t i = 0; i < rf._traceCount; ++i) {
+    const nrf905::TraceRecord &record = rf._trace[(first + i) % rf._traceSize];
+
+    if (record.kind != nrf905::TraceMode) {
+      continue;
+    }
+    if ((record.status == nrf905::PowerDown) && (record.command != nrf905::PowerDown)) {
+      awake = record.command == via;
+      wakeTime = record.time;
+    }
+    if ((record.command == nrf905::Transmit) && (awake == true)) {
+      result.push_back(record.time - wakeTime);
+      awake = false;
+    }
+  }
+  return result;
+}
+
+// Between transactions the radio sleeps in the configured idle mode; it is awake and settled before it sends, and
+// the mode time sensors account for every millisecond
+TEST(Zehnder, IdleModes) {
+  const nrf905::Mode modes[] = {nrf905::Idle, nrf905::PowerDown};
+
+  for (const nrf905::Mode idleMode : modes) {
+    for (const bool carrierPin : {true, false}) {
+      SimulationOptions options;
+
+      options.idleMode = idleMode;
+      options.carrierPin = carrierPin;
+      options.traceSize = 1024;
+      FanSimulation sim(options);
+      const uint32_t start = millis();
+      uint32_t total = 0;
+
+      sim.boot();
+      ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.pollLatency_.getCount() == 3; }, 30000));
+      sim.runFor(1000);
+      EXPECT_EQ(sim.rf.getMode(), idleMode) << "idle mode " << idleMode << " CD " << carrierPin;
+
+      if (idleMode == nrf905::PowerDown) {
+        // With carrier detect through Receive and its settle time, else through the power-up of startTx()
+        const std::vector<uint32_t> wakes = wakeToTransmit(sim.rf, carrierPin ? nrf905::Receive : nrf905::Idle);
+
+        // Every poll after the one at boot
+        EXPECT_GE(wakes.size(), 2u) << "CD " << carrierPin;
+        for (const uint32_t wake : wakes) {
+          EXPECT_GE(wake, carrierPin ? (uint32_t) (FAN_RX_SETTLE * 1000) : (uint32_t) POWER_UP_TIME)
+              << "CD " << carrierPin;
+        }
+      }
+
+      for (uint8_t mode = 0; mode < nrf905::ModeNrOf; ++mode) {
+        total += sim.rf.getModeTime((nrf905::Mode) mode);
+      }
+      EXPECT_NEAR(total, millis() - start, nrf905::ModeNrOf) << "idle mode " << idleMode << " CD " << carrierPin;
+      EXPECT_GT(sim.rf.getModeTime(idleMode), (millis() - start) * 9 / 10)
+          << "idle mode " << idleMode << " CD " << carrierPin;
+      EXPECT_EQ(sim.radio.counters().violations, 0u);
+      EXPECT_EQ(sim.mainUnit.getQueries(), 3u);
+    }
+  }
+}
+
+// The last confirmed state shows right after a reboot, marked stale until the first poll
+TEST(Zehnder, RestoresStaleStateUntilPolled) {
+  FanSimulation sim;
+  FanProbe::SavedState saved{2, 50};
+  esphome::ESPPreferenceObject pref =
+      esphome::global_preferences->make_preference<FanProbe::SavedState>(esphome::fnv1_hash("zehnderrf_state"), true);
+
+  (void) pref.save(&saved);
+  sim.mainUnit.setSpeed(3);
+  sim.boot();
+  EXPECT_EQ(sim.fan.speed, 2);
+  EXPECT_TRUE(sim.fan.is_state_stale());
+
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.is_state_stale() == false; }, 5000));
+  EXPECT_EQ(sim.fan.speed, 3);
+}
+
+TEST(Zehnder, RunsWithRadioTask) {
+  SimulationOptions options;
+
+  options.interruptPins = true;
+  options.radioTask = true;
+  FanSimulation sim(options);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+  ASSERT_TRUE(sim.setSpeed(4, 0, 5000));
+  EXPECT_EQ(sim.fan.speed, 4);
+}
+
+// The binary capture: header, then the most recent records that fit, oldest first
+TEST(Zehnder, ReadsCaptureImage) {
+  SimulationOptions options;
+  zehnder::CaptureRecord record;
+  uint32_t previous = 0;
+  bool settings = false;
+
+  options.captureSize = 4;
+  FanSimulation sim(options);
+
+  sim.boot();
+  ASSERT_TRUE(sim.runUntil([&]() { return sim.fan.confirmed_; }, 5000));
+  ASSERT_TRUE(sim.setSpeed(2, 0, 5000));
+
+  std::vector<uint8_t> image(sim.fan.captureImageSize());
+  ASSERT_EQ(image.size(), FAN_CAPTURE_HEADER + (4 * sizeof(zehnder::CaptureRecord)));
+  ASSERT_EQ(sim.fan.readCapture(image.data(), image.size()), image.size());
+  EXPECT_EQ(memcmp(image.data(), "ZRFC", 4), 0);
+  EXPECT_EQ(image[4], FAN_CAPTURE_VERSION);
+  EXPECT_EQ(image[5], sizeof(zehnder::CaptureRecord));
+  EXPECT_EQ(image[6] | (image[7] << 8), 4);
+
+  for (size_t i = 0; i < 4; ++i) {
+    (void) memcpy(&record, &image[FAN_CAPTURE_HEADER + (i * sizeof(record))], sizeof(record));
+    EXPECT_GE(record.time, previous);
+    EXPECT_EQ(record.length, FAN_FRAMESIZE);
+    previous = record.time;
+    settings = settings || ((record.direction == zehnder::CaptureRx) &&
+                            (record.frame[5] == zehnder::FAN_TYPE_FAN_SETTINGS));
+  }
+  // The fan's answer to the set speed is among the newest frames
+  EXPECT_TRUE(settings);
+
+  // A smaller buffer keeps the newest records
+  std::vector<uint8_t> part(FAN_CAPTURE_HEADER + (2 * sizeof(zehnder::CaptureRecord)));
+  ASSERT_EQ(sim.fan.readCapture(part.data(), part.size()), part.size());
+  EXPECT_EQ(part[6], 2);
+  EXPECT_EQ(memcmp(&part[FAN_CAPTURE_HEADER], &image[FAN_CAPTURE_HEADER + (2 * sizeof(zehnder::CaptureRecord))],
+                   2 * sizeof(zehnder::CaptureRecord)),
+            0);
+  EXPECT_EQ(sim.fan.readCapture(part.data(), FAN_CAPTURE_HEADER - 1), 0u);
+}
+
+TEST(Zehnder, CaptureDisabledByDefault) {
+  FanSimulation sim;
+  uint8_t buffer[FAN_CAPTURE_HEADER];
+
+  sim.boot();
+  EXPECT_EQ(sim.fan.captureImageSize(), 0u);
+  EXPECT_EQ(sim.fan.readCapture(buffer, sizeof(buffer)), 0u);
+}
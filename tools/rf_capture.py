@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Decode a Zehnder RF frame capture, downloaded from the device or from an ESPHome log.
+
+Download the binary capture from web_server, or call the dump_capture service and save the device log, and run:
+
+    curl -u admin:<password> -o capture.zrfc http://zehnder-comfofan/capture
+    python3 tools/rf_capture.py capture.zrfc
+    python3 tools/rf_capture.py device.log
+
+Frames are printed one per line, oldest first; from a log, the last capture in it.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+CAPTURE_MAGIC = b"ZRFC"
+CAPTURE_VERSION = 1
+HEADER = struct.Struct("<4sBBH")
+FRAMESIZE = 16
+RECORD = struct.Struct(f"<IBBBB{FRAMESIZE}s")
+
+ANSI_RE = re.compile(r"\x1b\[[0-9;]*m")
+
+DIRECTIONS = ["RX", "TX"]
+
+# nrf905::Mode
+MODES = ["PowerDown", "Idle", "Receive", "Transmit"]
+
+# ZehnderRF::State
+STATES = [
+    "Startup",
+    "StartDiscovery",
+    "DiscoveryWaitForLinkRequest",
+    "DiscoveryWaitForJoinResponse",
+    "DiscoveryJoinComplete",
+    "Idle",
+    "WaitQueryResponse",
+    "WaitSetSpeedResponse",
+    "WaitSetSpeedConfirm",
+]
+
+COMMANDS = {
+    0x01: "SetVoltage",
+    0x02: "SetSpeed",
+    0x03: "SetTimer",
+    0x04: "JoinRequest",
+    0x05: "SetSpeedReply",
+    0x06: "JoinOpen",
+    0x07: "FanSettings",
+    0x0B: "LinkAck",
+    0x0C: "JoinAck",
+    0x0D: "QueryNetwork",
+    0x10: "QueryDevice",
+    0x1D: "SetVoltageReply",
+}
+
+
+def name(names, index):
+    return names[index] if index < len(names) else f"?{index}"
+
+
+def extract(lines, prefix="capture"):
+    """Bytes of the last complete hex dump with this prefix in the log."""
+    line_re = re.compile(re.escape(prefix) + r": (begin|end|[0-9A-F]+$)")
+    capture = None
+    current = None
+
+    for line in lines:
+        match = line_re.search(ANSI_RE.sub("", line).rstrip())
+        if match is None:
+            continue
+        token = match.group(1)
+        if token == "begin":
+            current = []
+        elif token == "end":
+            if current is not None:
+                capture = "".join(current)
+            current = None
+        elif current is not None:
+            current.append(token)
+
+    if capture is None:
+        raise ValueError(f"no complete {prefix} found")
+    return bytes.fromhex(capture)
+
+
+def parse(data):
+    """List of (time_us, direction, mode, state, length, frame) tuples."""
+    magic, version, record_size, count = HEADER.unpack_from(data)
+    if magic != CAPTURE_MAGIC:
+        raise ValueError("not a frame capture")
+    if version != CAPTURE_VERSION or record_size != RECORD.size:
+        raise ValueError(f"unsupported capture version {version}, record size {record_size}")
+    if len(data) < HEADER.size + (count * RECORD.size):
+        raise ValueError(f"capture truncated, {count} frames announced")
+
+    return [RECORD.unpack_from(data, HEADER.size + (i * RECORD.size)) for i in range(count)]
+
+
+def load(data):
+    """Capture bytes from a binary download or from a log holding a dump."""
+    if data.startswith(CAPTURE_MAGIC):
+        return data
+    return extract(data.decode(errors="replace").splitlines())
+
+
+def describe(frame):
+    rx_type, rx_id, tx_type, tx_id, ttl, command, count = frame[:7]
+    parameters = frame[7 : 7 + min(count, 9)]
+    return (
+        f"{tx_type:02X}:{tx_id:02X} -> {rx_type:02X}:{rx_id:02X} ttl={ttl:3d} "
+        f"{COMMANDS.get(command, f'0x{command:02X}'):15s} {parameters.hex(' ')}"
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", type=argparse.FileType("rb"), default=sys.stdin.buffer)
+    args = parser.parse_args()
+
+    try:
+        with args.capture:
+            records = parse(load(args.capture.read()))
+    except ValueError as err:
+        sys.exit(f"rf_capture: {err}")
+
+    previous = None
+    for time, direction, mode, state, length, frame in records:
+        # micros() wraps every 71 minutes
+        gap = 0 if previous is None else ((time - previous) & 0xFFFFFFFF) / 1000
+        previous = time
+        if length >= FRAMESIZE:
+            content = describe(frame)
+        else:
+            content = f"short ({length}) {frame[:length].hex(' ')}"
+        line = (
+            f"{time / 1e6:12.6f} +{gap:9.3f}ms {name(DIRECTIONS, direction)} "
+            f"{name(MODES, mode):9s} {name(STATES, state):28s} {content}"
+        )
+        print(line.rstrip())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+"""Decode an nRF905 SPI trace from an ESPHome log and report bus occupancy.
+
+Set spi_trace_size on the nrf905 component, call the dump_spi_trace service, save the device log and run:
+
+    python3 tools/spi_trace.py device.log                     # trace and report
+    python3 tools/spi_trace.py device.log --baseline old.log  # fail when SPI traffic per poll cycle went up
+
+The report splits the trace into poll cycles at the marks the zehnder component records before each query.
+"""
+
+import argparse
+import struct
+import sys
+
+from rf_capture import MODES, extract, name
+
+TRACE_MAGIC = b"ZRFT"
+TRACE_VERSION = 1
+HEADER = struct.Struct("<4sBBH")
+RECORD = struct.Struct("<IBBBB")
+
+TRACE_SPI, TRACE_MODE, TRACE_MARK = range(3)
+
+# zehnder TraceMark tags
+MARKS = {0x01: "poll"}
+MARK_POLL = 0x01
+
+COMMANDS = {
+    0x20: "W_TX_PAYLOAD",
+    0x21: "R_TX_PAYLOAD",
+    0x22: "W_TX_ADDRESS",
+    0x23: "R_TX_ADDRESS",
+    0x24: "R_RX_PAYLOAD",
+    0xFF: "NOP",
+}
+
+
+def command_name(command):
+    if command in COMMANDS:
+        return COMMANDS[command]
+    if command & 0x80:
+        return "CHANNEL_CONFIG"
+    if command < 0x10:
+        return f"W_CONFIG+{command:X}"
+    if command < 0x20:
+        return f"R_CONFIG+{command & 0x0F:X}"
+    return f"0x{command:02X}"
+
+
+def parse(data):
+    """List of (time_us, kind, command, length, status) tuples."""
+    magic, version, record_size, count = HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC:
+        raise ValueError("not an SPI trace")
+    if version != TRACE_VERSION or record_size != RECORD.size:
+        raise ValueError(f"unsupported trace version {version}, record size {record_size}")
+    if len(data) < HEADER.size + (count * RECORD.size):
+        raise ValueError(f"trace truncated, {count} records announced")
+
+    return [RECORD.unpack_from(data, HEADER.size + (i * RECORD.size)) for i in range(count)]
+
+
+def elapsed(start, end):
+    # micros() wraps every 71 minutes
+    return (end - start) & 0xFFFFFFFF
+
+
+def print_trace(records):
+    previous = None
+    for time, kind, command, length, status in records:
+        gap = 0 if previous is None else elapsed(previous, time) / 1000
+        previous = time
+        if kind == TRACE_SPI:
+            event = f"SPI  {command_name(command):15s} {length:2d} bytes status=0x{status:02X}"
+        elif kind == TRACE_MODE:
+            event = f"MODE {name(MODES, status)} -> {name(MODES, command)}"
+        else:
+            event = f"MARK {MARKS.get(command, f'0x{command:02X}')}"
+        print(f"{time / 1e6:12.6f} +{gap:9.3f}ms {event}")
+
+
+def summarize(records):
+    spi = [r for r in records if r[1] == TRACE_SPI]
+    span = elapsed(records[0][0], records[-1][0]) / 1e6 if len(records) > 1 else 0
+    summary = {
+        "span": span,
+        "transactions": len(spi),
+        "bytes": sum(r[3] for r in spi),
+        "mode_writes": sum(1 for r in records if r[1] == TRACE_MODE),
+        "commands": {},
+        "cycles": [],
+    }
+
+    for _, _, command, length, _ in spi:
+        count, total = summary["commands"].get(command_name(command), (0, 0))
+        summary["commands"][command_name(command)] = (count + 1, total + length)
+
+    # Complete cycles only: from one poll mark up to the next
+    cycle = None
+    for _, kind, command, length, _ in records:
+        if kind == TRACE_MARK and command == MARK_POLL:
+            if cycle is not None:
+                summary["cycles"].append(cycle)
+            cycle = [0, 0]
+        elif kind == TRACE_SPI and cycle is not None:
+            cycle[0] += 1
+            cycle[1] += length
+
+    return summary
+
+
+def per_cycle(summary):
+    """Mean (transactions, bytes) per poll cycle, None without complete cycles."""
+    cycles = summary["cycles"]
+    if not cycles:
+        return None
+    return (sum(c[0] for c in cycles) / len(cycles), sum(c[1] for c in cycles) / len(cycles))
+
+
+def print_summary(summary):
+    span = summary["span"]
+    print(f"Span:            {span:.3f} s")
+    print(f"SPI:             {summary['transactions']} transactions, {summary['bytes']} bytes")
+    if span > 0:
+        print(
+            f"Bus occupancy:   {summary['transactions'] / span:.1f} transactions/s, "
+            f"{summary['bytes'] / span:.1f} bytes/s"
+        )
+    print(f"Mode changes:    {summary['mode_writes']} setMode() GPIO writes")
+    mean = per_cycle(summary)
+    if mean is not None:
+        print(
+            f"Poll cycles:     {len(summary['cycles'])}, {mean[0]:.1f} transactions and {mean[1]:.1f} bytes "
+            f"per cycle (max {max(c[0] for c in summary['cycles'])} transactions)"
+        )
+    for command, (count, total) in sorted(summary["commands"].items(), key=lambda item: -item[1][1]):
+        print(f"  {command:15s} {count:6d} transactions {total:8d} bytes")
+
+
+def compare(summary, baseline, tolerance):
+    """True when SPI traffic per poll cycle stayed within tolerance (%) of the baseline."""
+    mean, base = per_cycle(summary), per_cycle(baseline)
+    if mean is None or base is None:
+        print("Compare: both traces need at least two poll marks")
+        return False
+
+    ok = True
+    for label, value, reference in (
+        ("transactions", mean[0], base[0]),
+        ("bytes", mean[1], base[1]),
+    ):
+        change = ((value - reference) / reference * 100) if reference else 0
+        regressed = value > reference * (1 + tolerance / 100)
+        ok = ok and not regressed
+        print(
+            f"Per cycle {label:12s} {reference:8.1f} -> {value:8.1f} ({change:+.1f}%)"
+            f"{'  REGRESSION' if regressed else ''}"
+        )
+    return ok
+
+
+def load(log):
+    with log:
+        records = parse(extract(log, "spi trace"))
+    if not records:
+        raise ValueError("trace is empty")
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    parser.add_argument("--summary", action="store_true", help="report only, no per transaction trace")
+    parser.add_argument("--baseline", type=argparse.FileType("r"), help="log with the trace to compare against")
+    parser.add_argument("--tolerance", type=float, default=0, help="allowed increase per poll cycle (%%)")
+    args = parser.parse_args()
+
+    try:
+        records = load(args.log)
+        baseline = load(args.baseline) if args.baseline else None
+    except ValueError as err:
+        sys.exit(f"spi_trace: {err}")
+
+    if not args.summary:
+        print_trace(records)
+        print()
+    summary = summarize(records)
+    print_summary(summary)
+
+    if baseline is not None:
+        print()
+        if not compare(summary, summarize(baseline), args.tolerance):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()